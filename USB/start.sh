@@ -1,13 +1,13 @@
 #!/bin/sh
-# Kill the64
-until [ `ps | grep -e the64 | wc -l` -eq 1 ]
-do
-        killall the64
-done
-
 mount -o remount,rw /mnt
 cd /mnt
 
-./gamepad_map
+# Stops the64, runs the mapper and starts the64 again on exit
+./gamepad_map --launch --telemetry /mnt/gamepad_map.tlm
 
-the64 &
+# Killed before it could restart the64 (crash, OOM, SIGKILL): the shell
+# reports 128 + signal. A normal exit has already started it, possibly
+# still under the mapper's name, so pidof alone would race.
+if [ $? -ge 128 ] && ! pidof the64 >/dev/null; then
+        the64 &
+fi
@@ -10,12 +10,31 @@
  * Dependencies: only libc (uses Linux framebuffer and evdev ioctls directly)
  *
  * Cross-compile:
- *   arm-linux-gnueabihf-gcc -static -O2 -o gamepad_map gamepad_map.c
+ *   arm-linux-gnueabihf-gcc -static -O2 -pthread -o gamepad_map gamepad_map.c
  *
  * Host compile (for testing):
- *   gcc -O2 -o gamepad_map gamepad_map.c
+ *   gcc -O2 -pthread -o gamepad_map gamepad_map.c
+ *
+ * Headless use (no framebuffer):
+ *   gamepad_map --cli /dev/input/event3 -o /mnt [-s script.txt]
+ *   gamepad_map --batch devices.txt
+ *
+ * Launcher (used by start.sh): stops the64, runs the GUI, restarts the64
+ *   gamepad_map --launch
+ *
+ * Screen recording (convert on the host with gamepad_rec2png.c):
+ *   gamepad_map --record /mnt/session.rec
+ *
+ * Session telemetry (summarise on the host with gamepad_tlm.c):
+ *   gamepad_map --telemetry /mnt/gamepad_map.tlm
+ *
+ * Watcher daemon: sleeps until a pad missing from gamecontrollerdb.txt
+ * is plugged in, then runs the --launch flow for it
+ *   gamepad_map --watch --db /usr/share/the64/ui/data/gamecontrollerdb.txt
  */
 
+#define _GNU_SOURCE     /* CPU_SET, pthread_attr_setaffinity_np */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,10 +44,21 @@
 #include <dirent.h>
 #include <errno.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <time.h>
+#include <poll.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <linux/fb.h>
 #include <linux/input.h>
 
@@ -36,13 +66,23 @@
  * Constants
  * ================================================================ */
 
-#define MAX_CONTROLLERS   8
 #define MAX_PATH_LEN      512
 #define MAX_NAME_LEN      256
-#define MAX_DIR_ENTRIES   256
+#define BROWSER_PAGE       64   /* directory entries read at a time */
+#define DIR_CACHE_SLOTS    16
 #define GUID_STR_LEN      33
 #define NUM_MAPPINGS       10
 
+#define MAX_AXES           32   /* per device; further axes are ignored */
+#define NUM_BTN_CODES     (KEY_MAX - BTN_MISC + 1)
+#define NUM_HAT_CODES     (ABS_HAT3Y - ABS_HAT0X + 1)
+
+#define CALIB_NOISE_SIGMAS  4   /* deadzone in standard deviations at rest */
+#define CALIB_DERIVE_EVERY 32   /* rest samples between re-derivations */
+#define CALIB_MAX_SAMPLES 1024  /* sample count saturates here */
+#define CALIB_RESEED_RUN   32   /* clustered samples off the estimate that
+                                   move it there */
+
 #define FONT_W             8
 #define FONT_H             16
 
@@ -53,6 +93,36 @@
 #define NAV_REPEAT_RATE    120
 #define FRAME_MS            16
 
+#define READY_EVENTS       16   /* ready fds taken per epoll_wait */
+#define MERGE_SOURCES      32   /* devices merged in one pass */
+#define MERGE_BATCH        16   /* events read per device per read() */
+#define DETECT_ROW_H       24
+#define DETECT_ACTIVE_MS  1000   /* highlight a pad this long after input */
+
+#define SAVE_QUEUE_LEN      4
+
+#define CTL_MAX_CLIENTS     4
+#define CTL_LINE_MAX      256
+#define CTL_OUT_MAX      8192   /* backlog above which requests wait */
+#define CTL_CMDS_PER_FRAME 64
+
+#define TLM_NAME_LEN       40   /* controller name bytes per record */
+#define TLM_RECORD_LEN    136
+#define TLM_BUF_LEN       (16 * TLM_RECORD_LEN)
+#define TLM_MAGIC      0x4C54   /* "TL" */
+
+#define REC_TILE           16   /* recording diff granularity, pixels */
+#define REC_SLOTS           3   /* frames buffered for the writer */
+
+#define THE64_TERM_MS    3000   /* SIGTERM grace period before SIGKILL */
+#define THE64_KILL_MS    1000
+#define MAX_THE64_PIDS      8
+
+#define MAX_PROF_PHASES    12
+
+#define RT_PRIORITY        50   /* SCHED_FIFO priority of the main loop */
+#define WORKER_STACK   (128 * 1024)
+
 #define BITS_PER_LONG     (sizeof(long) * 8)
 #define NBITS(x)          ((((x) - 1) / BITS_PER_LONG) + 1)
 #define TEST_BIT(bit, a)  ((a[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
@@ -194,6 +264,32 @@ typedef struct {
     size_t    size;
 } Framebuffer;
 
+/* Axis calibration is streamed: samples near rest feed a Welford mean and
+ * variance, every sample widens the observed extremes, and the centre,
+ * deadzone and thresholds are re-derived every CALIB_DERIVE_EVERY rest
+ * samples. Until the first rest sample arrives, a steady cluster of
+ * samples near the middle of the range re-seeds a misplaced seed. */
+typedef struct {
+    int32_t min;
+    int32_t max;
+    int32_t flat;          /* kernel-reported flat zone */
+    int32_t center;        /* estimated rest position */
+    int32_t deadzone;      /* noise floor around center */
+    int32_t thresh;        /* deflection from center that counts as pressed */
+    int32_t thresh_off;    /* deflection below which a press is released */
+    int32_t rest_window;   /* samples further than this are not rest */
+    int32_t obs_min;       /* observed extremes */
+    int32_t obs_max;
+    uint32_t n;            /* rest samples, capped at CALIB_MAX_SAMPLES */
+    float   mean;
+    float   m2;            /* sum of squared deviations from mean */
+    uint32_t stray;        /* consecutive samples outside rest_window ... */
+    float   stray_mean;    /* ... that stay together, and their mean */
+    int8_t  state;         /* last direction reported by ctrl_axis_dir */
+} AxisInfo;
+
+/* Per-device lookup tables are indexed by event code relative to the
+ * first code that can be mapped, and hold -1 or a small SDL index. */
 typedef struct {
     int              fd;
     char             path[MAX_PATH_LEN];
@@ -203,12 +299,12 @@ typedef struct {
     int              num_buttons;
     int              num_axes;
     int              num_hats;
-    int              btn_map[KEY_MAX];
-    int              abs_map[ABS_MAX];
-    int              hat_map[ABS_MAX];
-    int              axis_initial[ABS_MAX];
-    int              axis_min[ABS_MAX];
-    int              axis_max[ABS_MAX];
+    int              probed;       /* maps below filled by probe_controller */
+    int              mono_clock;   /* event timestamps are CLOCK_MONOTONIC */
+    AxisInfo         axes[MAX_AXES];          /* by SDL axis index */
+    int8_t           btn_map[NUM_BTN_CODES];  /* code - BTN_MISC -> button */
+    int8_t           abs_map[ABS_CNT];        /* code -> axis index */
+    int8_t           hat_map[NUM_HAT_CODES];  /* code - ABS_HAT0X -> hat */
 } Controller;
 
 typedef enum { MAP_NONE = 0, MAP_BUTTON, MAP_AXIS, MAP_HAT } MapType;
@@ -223,17 +319,48 @@ typedef struct {
     int         hat_mask;
 } MappingEntry;
 
+/* Complete directory listings keyed by path and validated by the
+ * directory's mtime. A worker thread fills it ahead of the browser. */
 typedef struct {
-    char name[MAX_NAME_LEN];
-    int  is_dir;
-} DirEntry;
+    char            path[MAX_PATH_LEN];   /* "" = free slot */
+    struct timespec mtime;
+    char           *names;
+    size_t          names_len;
+    uint32_t       *index;
+    int             num_dirs;
+    unsigned        last_used;
+} DirCacheEntry;
 
 typedef struct {
-    char     path[MAX_PATH_LEN];
-    DirEntry entries[MAX_DIR_ENTRIES];
-    int      count;
-    int      selected;
-    int      scroll;
+    pthread_mutex_t lock;
+    DirCacheEntry   slots[DIR_CACHE_SLOTS];
+    unsigned        clock;
+    pthread_t       thread;
+    pthread_cond_t  cond;
+    char            want[MAX_PATH_LEN];   /* next directory to prefetch */
+    int             running;
+    volatile int    stop;
+} DirCache;
+
+/* Rows are: optional "..", the subdirectories in sorted order, then the
+ * export action. Subdirectories are read BROWSER_PAGE at a time while
+ * the directory stream is open, as the selection nears the last row. */
+typedef struct {
+    char      path[MAX_PATH_LEN];
+    DIR      *dir;          /* non-NULL while entries remain to be read */
+    char     *names;        /* string arena of NUL-terminated names */
+    size_t    names_len;
+    size_t    names_cap;
+    uint32_t *index;        /* arena offsets, sorted case-insensitively */
+    int       num_dirs;
+    int       index_cap;
+    int       has_parent;   /* ".." row present */
+    int       count;        /* total rows */
+    int       selected;
+    int       scroll;
+    DirCache *cache;        /* optional listing cache */
+    struct timespec mtime;  /* directory mtime when the stream opened */
+    int       complete;     /* every entry has been read */
 } DirBrowser;
 
 typedef enum {
@@ -241,41 +368,208 @@ typedef enum {
     STATE_MAPPING,
     STATE_REVIEW,
     STATE_BROWSE,
+    STATE_TEST,
     STATE_DONE,
     STATE_EXIT
 } AppState;
 
+/* Derived review-screen data, rebuilt only when a MappingEntry changes */
+typedef struct {
+    unsigned version;        /* bumped by mappings_changed() */
+    unsigned built_version;  /* version the fields below reflect */
+    int      has_dupes;
+    char     mapped_to[NUM_MAPPINGS][32];   /* "Button 3" */
+    char     gcdb_value[NUM_MAPPINGS][48];  /* "lefttrigger:b3" */
+    char     dups[NUM_MAPPINGS][256];       /* "Menu 1, Menu 2" */
+} ReviewModel;
+
+/* Background save worker: the main loop queues jobs, the worker writes
+ * them (write + fsync + rename) and queues the results back. */
+typedef struct {
+    char path[MAX_PATH_LEN];
+    char data[1024];
+    int  err;               /* errno on failure, 0 on success */
+} SaveJob;
+
+typedef struct {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    SaveJob         jobs[SAVE_QUEUE_LEN];
+    int             job_head, job_count;
+    SaveJob         done[SAVE_QUEUE_LEN];
+    int             done_head, done_count;
+    int             running;
+    int             stop;
+} SaveQueue;
+
+/* Telemetry: per-session counters live in cur; a finished session is
+ * encoded into buf and appended to the log file. */
+enum { TLM_END_ANOTHER = 1, TLM_END_QUIT = 2 };
+
+typedef struct {
+    int       active;
+    uint64_t  start_ms;
+    uint32_t  start_time;            /* wall clock */
+    char      guid[GUID_STR_LEN];
+    char      name[TLM_NAME_LEN];
+    uint32_t  prompt_ms[NUM_MAPPINGS];
+    uint64_t  prompt_start;          /* ms, 0 = no prompt showing */
+    unsigned  redos, restarts, dup_warnings, save_failures;
+    uint32_t  save_ms;
+} TlmSession;
+
+typedef struct {
+    int        fd;                   /* -1 = telemetry off */
+    TlmSession cur;
+    uint8_t    buf[TLM_BUF_LEN];     /* encoded records not yet written */
+    size_t     len;
+    unsigned   dropped;
+} Telemetry;
+
+/* Screen recorder: the main loop copies the tiles that changed since the
+ * last recorded frame into a free slot, the writer thread RLE-encodes
+ * and writes them. With no free slot the frame is dropped, never the UI
+ * frame rate; the next frame is diffed against the last one recorded. */
+typedef struct {
+    uint32_t  ms;              /* since recording started */
+    int       ntiles;
+    uint16_t *pos;             /* tile column, row pairs */
+    uint32_t *px;              /* tile pixels, REC_TILE^2 per tile */
+} RecFrame;
+
+typedef struct {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             fd;
+    int             width, height;
+    int             tiles_x, tiles_y;
+    uint32_t       *prev;      /* last frame handed to the writer */
+    RecFrame        slots[REC_SLOTS];
+    int             head, count;
+    uint8_t        *out;       /* writer's encode buffer */
+    uint64_t        start_ms;
+    unsigned        frames, dropped;
+    uint64_t        bytes;
+    int             running;
+    int             stop;
+    int             err;       /* errno of the first failed write */
+} Recorder;
+
+/* Control socket clients; see the Control socket section */
+typedef struct {
+    int    fd;                       /* -1 = free slot */
+    char   in[CTL_LINE_MAX];
+    size_t in_len;
+    char  *out;                      /* pending response, grows to fit */
+    size_t out_len, out_cap;
+    int    overflow;                 /* out of memory for a response: drop */
+} CtlClient;
+
+typedef struct {
+    int       listen_fd;             /* -1 = no control socket */
+    char      path[108];
+    CtlClient clients[CTL_MAX_CLIENTS];
+} Control;
+
 /* Review screen action items (after the 10 mapping rows) */
 #define REVIEW_ACTION_SAVE    NUM_MAPPINGS       /* index 10 */
-#define REVIEW_ACTION_RESTART (NUM_MAPPINGS + 1) /* index 11 */
-#define REVIEW_ACTION_ANOTHER (NUM_MAPPINGS + 2) /* index 12 */
-#define REVIEW_ACTION_QUIT    (NUM_MAPPINGS + 3) /* index 13 */
-#define REVIEW_TOTAL_ITEMS    (NUM_MAPPINGS + 4) /* 14 items */
+#define REVIEW_ACTION_TEST    (NUM_MAPPINGS + 1) /* index 11 */
+#define REVIEW_ACTION_RESTART (NUM_MAPPINGS + 2) /* index 12 */
+#define REVIEW_ACTION_ANOTHER (NUM_MAPPINGS + 3) /* index 13 */
+#define REVIEW_ACTION_QUIT    (NUM_MAPPINGS + 4) /* index 14 */
+#define REVIEW_TOTAL_ITEMS    (NUM_MAPPINGS + 5) /* 15 items */
+
+/* Individually drawable parts of the graphic. Buttons share the index of
+ * their MappingEntry; the stick stands for both leftx and lefty. */
+enum {
+    JE_LFIRE, JE_RFIRE, JE_LTRI, JE_RTRI, JE_M1, JE_M2, JE_M3, JE_M4,
+    JE_STICK, NUM_JOY_ELEMS
+};
+
+/* Live input test screen. Raw state is updated from events; the drawn_*
+ * fields remember what is on screen so only changes are redrawn. */
+typedef struct {
+    uint8_t   btn_down[INT8_MAX];
+    int32_t   axis_val[MAX_AXES];
+    uint8_t   hat_bits[4];           /* SDL hat masks currently held */
+    int       active[NUM_MAPPINGS];
+    int       stick_dx, stick_dy;
+    int       mono_clock;            /* event timestamps are CLOCK_MONOTONIC */
+    uint64_t  last_event_us;         /* 0 = no event yet */
+    char      last_desc[32];
+    uint64_t  hold_start;            /* Menu 4 held since (ms), 0 = not held */
+    int       drawn;                 /* full frame is on screen */
+    int       drawn_active[NUM_JOY_ELEMS];
+    int       drawn_dx, drawn_dy;
+    char      drawn_text[3][128];
+    uint32_t *base;                  /* graphic area with only the body */
+    int       ox, oy;                /* graphic origin */
+} TestView;
+
+/* Pending events of several devices, handed out oldest first. Each
+ * source buffers one read() worth of events, kept across passes until
+ * taken; the heap orders the sources of the current pass by the
+ * timestamp of their next event. */
+typedef struct {
+    int                fd;
+    int                group;      /* epoll set it was found through, -1 */
+    int                active;     /* in the current pass's heap */
+    int                pos, len;   /* unread events are buf[pos..len) */
+    struct input_event buf[MERGE_BATCH];
+} MergeSource;
+
+typedef struct {
+    MergeSource src[MERGE_SOURCES];
+    uint8_t     heap[MERGE_SOURCES];
+    int         num_src, num_heap;
+} EventMerge;
 
 typedef struct {
     Framebuffer  fb;
     AppState     state;
-    Controller   controllers[MAX_CONTROLLERS];
-    int          num_controllers;
+    /* device registry: grows as needed; fd_slot[fd] is the controller
+     * index for an open controller fd, -1 otherwise */
+    Controller  *controllers;
+    int          num_controllers, cap_controllers;
+    int32_t     *fd_slot;
+    int          fd_slot_cap;
+    int          ctrl_epfd;          /* readiness of all controllers */
     int          sel_ctrl;
+    int          detect_scroll;      /* first controller row shown */
+    int          detect_active;      /* pad that last sent input, -1 = none */
+    uint64_t     detect_active_time;
     MappingEntry mappings[NUM_MAPPINGS];
     int          cur_map;
     int          redo_single;        /* -1 = normal, >=0 = redo that one */
     DirBrowser   browser;
+    DirCache     dircache;
+    Recorder     rec;
+    Telemetry    tlm;
+    Control      ctl;
     int          blink;
     uint64_t     blink_time;
     uint64_t     last_scan;
     int          review_sel;
     char         save_path[MAX_PATH_LEN];
+    SaveQueue    saveq;
+    SaveJob      save_retry;         /* queue was full; path "" = none */
+    int          save_pending;       /* jobs queued but not yet reported */
+    int          save_err;           /* errno of last failed save, 0 = ok */
     char         mapping_str[1024];
+    ReviewModel  review;
+    TestView     test;
     /* navigation repeat */
     int          nav_held_dir;       /* -1=up, 1=down, 0=none */
     uint64_t     nav_repeat_time;
     /* keyboard input */
-    int          kbd_fds[8];
-    int          num_kbd_fds;
+    int         *kbd_fds;
+    int          num_kbd_fds, cap_kbd_fds;
+    int          kbd_epfd;
     /* THEJOYSTICK as always-available navigator (-1 = not available) */
     int          thec64_nav_idx;
+    EventMerge   merge;              /* input read but not yet handled */
 } App;
 
 static volatile sig_atomic_t g_quit = 0;
@@ -296,6 +590,78 @@ static uint64_t time_ms(void)
     return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+static uint64_t time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Little-endian stores for the on-disk record formats */
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v; p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+    return p + 4;
+}
+
+/* ================================================================
+ * Startup profiling
+ * ================================================================ */
+
+typedef struct {
+    const char *name;
+    uint64_t    us;      /* duration of the phase */
+} ProfPhase;
+
+static ProfPhase g_prof[MAX_PROF_PHASES];
+static int       g_prof_count;
+static uint64_t  g_prof_start, g_prof_last;
+
+static void prof_begin(void)
+{
+    g_prof_start = g_prof_last = time_us();
+}
+
+/* End the current phase and record it under name */
+static void prof_mark(const char *name)
+{
+    uint64_t now = time_us();
+    if (g_prof_count < MAX_PROF_PHASES)
+        g_prof[g_prof_count++] = (ProfPhase){ name, now - g_prof_last };
+    g_prof_last = now;
+}
+
+static void prof_report(void)
+{
+    uint64_t total = 0;
+    fprintf(stderr, "Startup profile:\n");
+    for (int i = 0; i < g_prof_count; i++) {
+        total += g_prof[i].us;
+        fprintf(stderr, "  %-20s %8.2f ms  (at %8.2f ms)\n", g_prof[i].name,
+                g_prof[i].us / 1000.0, total / 1000.0);
+    }
+}
+
 /* ================================================================
  * Framebuffer
  * ================================================================ */
@@ -351,7 +717,7 @@ static int fb_init(Framebuffer *fb)
         return -1;
     }
 
-    memset(fb->backbuf, 0, fb->size);
+    /* no memset: the first fb_clear() writes every pixel anyway */
     fprintf(stderr, "Framebuffer: %dx%d, stride=%d px\n",
             fb->width, fb->height, fb->stride_px);
     return 0;
@@ -362,6 +728,20 @@ static void fb_flip(Framebuffer *fb)
     memcpy(fb->pixels, fb->backbuf, fb->size);
 }
 
+/* Copy one rectangle of the backbuffer to the screen */
+static void fb_flip_rect(Framebuffer *fb, int x, int y, int w, int h)
+{
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > fb->width)  w = fb->width - x;
+    if (y + h > fb->height) h = fb->height - y;
+    if (w <= 0 || h <= 0) return;
+    for (int row = y; row < y + h; row++)
+        memcpy(fb->pixels + row * fb->stride_px + x,
+               fb->backbuf + row * fb->stride_px + x,
+               (size_t)w * sizeof(uint32_t));
+}
+
 static void fb_clear(Framebuffer *fb, uint32_t color)
 {
     int total = fb->stride_px * fb->height;
@@ -377,6 +757,104 @@ static void fb_destroy(Framebuffer *fb)
     if (fb->fd >= 0) close(fb->fd);
 }
 
+/* ================================================================
+ * Realtime mode
+ *
+ * The main loop (input polling and rendering) runs SCHED_FIFO on its
+ * own core with all memory locked; the save and prefetch workers stay
+ * SCHED_OTHER on a different core.
+ * ================================================================ */
+
+typedef struct {
+    int enabled;
+    int main_cpu;      /* -1 = default */
+    int worker_cpu;    /* -1 = default */
+} RtConfig;
+
+static RtConfig g_rt = { 0, -1, -1 };
+
+/* Worst-case frame timing, reported at exit for either mode */
+typedef struct {
+    uint64_t frames;
+    uint64_t work_max_us;    /* update + render + flip */
+    uint64_t late_max_us;    /* wake-up overshoot after the frame sleep */
+    uint64_t late_sum_us;
+} FrameStats;
+
+static void frame_stats_report(const FrameStats *st)
+{
+    if (!st->frames) return;
+    fprintf(stderr,
+            "Frame latency (%s mode, %llu frames): work max %.2f ms, "
+            "wake-up late max %.2f ms, avg %.3f ms\n",
+            g_rt.enabled ? "realtime" : "normal",
+            (unsigned long long)st->frames, st->work_max_us / 1000.0,
+            st->late_max_us / 1000.0,
+            st->late_sum_us / 1000.0 / st->frames);
+}
+
+/* Parse "MAIN[,WORKER]" cpu numbers */
+static int parse_cpus(const char *arg)
+{
+    int n = sscanf(arg, "%d,%d", &g_rt.main_cpu, &g_rt.worker_cpu);
+    return n >= 1 && g_rt.main_cpu >= 0 ? 0 : -1;
+}
+
+static void realtime_setup(Framebuffer *fb)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    long page_px = sysconf(_SC_PAGESIZE) / (long)sizeof(uint32_t);
+    cpu_set_t set;
+
+    if (g_rt.main_cpu < 0)
+        g_rt.main_cpu = ncpu > 1 ? (int)ncpu - 1 : 0;
+    if (g_rt.worker_cpu < 0)
+        g_rt.worker_cpu = 0;
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        perror("mlockall");
+
+    /* touch every page of both buffers so the first frames never fault */
+    for (size_t i = 0; i < fb->size / sizeof(uint32_t); i += page_px) {
+        fb->backbuf[i] = 0;
+        ((volatile uint32_t *)fb->pixels)[i] = fb->pixels[i];
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(g_rt.main_cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        perror("sched_setaffinity");
+
+    struct sched_param sp = { .sched_priority = RT_PRIORITY };
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+        perror("sched_setscheduler");
+
+    fprintf(stderr, "Realtime: SCHED_FIFO %d on cpu %d, workers on cpu %d\n",
+            RT_PRIORITY, g_rt.main_cpu, g_rt.worker_cpu);
+}
+
+/* Start a background thread: small stack (it is locked in realtime mode),
+ * normal scheduling and, in realtime mode, the worker core. */
+static int start_worker(pthread_t *thread, void *(*fn)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    int rc;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    if (g_rt.enabled) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(g_rt.worker_cpu, &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+    rc = pthread_create(thread, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+    return rc;
+}
+
 /* ================================================================
  * Drawing primitives
  * ================================================================ */
@@ -459,15 +937,214 @@ static void draw_triangle_filled(Framebuffer *fb, int x0, int y0,
 }
 
 /* ================================================================
- * Text rendering (built-in 8x16 font)
+ * External font (PSF2) for characters outside printable ASCII
+ *
+ * The file is mmap'd and only its header is checked at startup. The
+ * codepoint -> glyph page table is built the first time a non-ASCII
+ * character is drawn, and glyphs are decoded into a small cache as
+ * they are used. ASCII always uses the built-in font.
+ * ================================================================ */
+
+#define PSF2_MAGIC      0x864AB572
+#define PSF2_HAS_TABLE  0x01
+#define FONT_FILE       "font.psf"  /* tried in the working directory */
+#define FONT_PAGES      (0x110000 / 256)
+#define GLYPH_CACHE     64          /* direct-mapped by codepoint */
+#define GLYPH_NONE      0xFFFF
+
+typedef struct {
+    uint32_t cp;                     /* 0 = empty */
+    uint8_t  rows[FONT_H];
+} CachedGlyph;
+
+typedef struct {
+    const uint8_t *map;              /* whole file, NULL = no font */
+    size_t         size;
+    const uint8_t *bitmaps;
+    const uint8_t *table;            /* unicode table, NULL = index is cp */
+    uint32_t       glyphs, charsize, width, height, row_bytes;
+    int            indexed;
+    uint16_t       page_of[FONT_PAGES];  /* 0 = none, else pages[n - 1] */
+    uint16_t     (*pages)[256];
+    int            num_pages;
+    CachedGlyph    cache[GLYPH_CACHE];
+} Font;
+
+static Font g_font;
+
+/* Decode one UTF-8 sequence and advance *s past it. Malformed input
+ * yields U+FFFD and consumes one byte. */
+static uint32_t utf8_next(const char **s)
+{
+    const uint8_t *p = (const uint8_t *)*s;
+    uint32_t cp;
+    int n;
+
+    if (p[0] < 0x80)               { *s += 1; return p[0]; }
+    else if ((p[0] & 0xE0) == 0xC0) { cp = p[0] & 0x1F; n = 1; }
+    else if ((p[0] & 0xF0) == 0xE0) { cp = p[0] & 0x0F; n = 2; }
+    else if ((p[0] & 0xF8) == 0xF0) { cp = p[0] & 0x07; n = 3; }
+    else                            { *s += 1; return 0xFFFD; }
+
+    for (int i = 1; i <= n; i++) {
+        if ((p[i] & 0xC0) != 0x80) { *s += 1; return 0xFFFD; }
+        cp = cp << 6 | (p[i] & 0x3F);
+    }
+    *s += n + 1;
+    return cp < 0x110000 ? cp : 0xFFFD;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Map a PSF2 file. Returns -1 (and keeps the built-in font only) if it
+ * cannot be used. */
+static int font_load(const char *path, int quiet)
+{
+    Font *f = &g_font;
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        if (!quiet) perror(path);
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < 32) {
+        close(fd);
+        fprintf(stderr, "%s: not a PSF2 font\n", path);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+
+    const uint8_t *h = map;
+    uint32_t hdr = get_le32(h + 8), flags = get_le32(h + 12);
+    f->glyphs = get_le32(h + 16);
+    f->charsize = get_le32(h + 20);
+    f->height = get_le32(h + 24);
+    f->width = get_le32(h + 28);
+    f->row_bytes = (f->width + 7) / 8;
+
+    if (get_le32(h) != PSF2_MAGIC || f->width == 0 || f->height == 0 ||
+        f->width > FONT_W || f->height > FONT_H ||
+        f->charsize < f->row_bytes * f->height || hdr > (size_t)st.st_size ||
+        f->glyphs > ((size_t)st.st_size - hdr) / f->charsize) {
+        fprintf(stderr, "%s: not a PSF2 font of at most %dx%d\n", path,
+                FONT_W, FONT_H);
+        munmap(map, st.st_size);
+        memset(f, 0, sizeof(*f));
+        return -1;
+    }
+    f->map = map;
+    f->size = st.st_size;
+    f->bitmaps = f->map + hdr;
+    if (flags & PSF2_HAS_TABLE)
+        f->table = f->bitmaps + (size_t)f->glyphs * f->charsize;
+    return 0;
+}
+
+static void font_unload(void)
+{
+    if (g_font.map)
+        munmap((void *)g_font.map, g_font.size);
+    free(g_font.pages);
+    memset(&g_font, 0, sizeof(g_font));
+}
+
+static void font_index_set(Font *f, uint32_t cp, uint16_t glyph)
+{
+    uint32_t pg = cp >> 8;
+    if (!f->page_of[pg]) {
+        if (f->num_pages >= GLYPH_NONE) return;
+        uint16_t (*p)[256] = realloc(f->pages,
+                                     (f->num_pages + 1) * sizeof(*p));
+        if (!p) return;
+        f->pages = p;
+        memset(f->pages[f->num_pages], 0xFF, sizeof(*p));  /* GLYPH_NONE */
+        f->page_of[pg] = ++f->num_pages;
+    }
+    uint16_t *slot = &f->pages[f->page_of[pg] - 1][cp & 0xFF];
+    if (*slot == GLYPH_NONE)
+        *slot = glyph;  /* first mapping of a codepoint wins */
+}
+
+/* Build the two-level codepoint table from the PSF2 unicode table:
+ * per glyph, UTF-8 codepoints up to 0xFF, with 0xFE starting
+ * multi-codepoint sequences that are skipped here. */
+static void font_build_index(Font *f)
+{
+    const uint8_t *p = f->table, *end = f->map + f->size;
+
+    f->indexed = 1;
+    for (uint32_t g = 0; g < f->glyphs && g < GLYPH_NONE && p < end; g++) {
+        int in_seq = 0;
+        while (p < end && *p != 0xFF) {
+            if (*p == 0xFE) { in_seq = 1; p++; continue; }
+            /* copy so a sequence cut off by the end of file stops at NUL */
+            char seq[5] = { 0 };
+            memcpy(seq, p, end - p < 4 ? (size_t)(end - p) : 4);
+            const char *s = seq;
+            uint32_t cp = utf8_next(&s);
+            p += s - seq;
+            if (!in_seq && cp != 0xFFFD)
+                font_index_set(f, cp, g);
+        }
+        p++;  /* 0xFF */
+    }
+}
+
+static uint32_t font_glyph_index(Font *f, uint32_t cp)
+{
+    if (!f->table)
+        return cp < f->glyphs ? cp : GLYPH_NONE;
+    if (!f->indexed)
+        font_build_index(f);
+    uint16_t pg = f->page_of[cp >> 8];
+    return pg ? f->pages[pg - 1][cp & 0xFF] : GLYPH_NONE;
+}
+
+/* 8x16 rows for a non-ASCII codepoint; a hollow box if the font has no
+ * glyph for it */
+static const uint8_t *font_glyph(uint32_t cp)
+{
+    Font *f = &g_font;
+    CachedGlyph *cg = &f->cache[cp % GLYPH_CACHE];
+
+    if (cg->cp == cp)
+        return cg->rows;
+
+    uint32_t g = f->map ? font_glyph_index(f, cp) : GLYPH_NONE;
+    cg->cp = cp;
+    memset(cg->rows, 0, sizeof(cg->rows));
+    if (g == GLYPH_NONE || g >= f->glyphs) {
+        cg->rows[3] = cg->rows[12] = 0x7E;
+        for (int r = 4; r < 12; r++) cg->rows[r] = 0x42;
+        return cg->rows;
+    }
+    /* narrow or short glyphs sit centred vertically, left-aligned */
+    const uint8_t *src = f->bitmaps + (size_t)g * f->charsize;
+    int top = (FONT_H - f->height) / 2;
+    for (uint32_t r = 0; r < f->height; r++)
+        cg->rows[top + r] = src[r * f->row_bytes];
+    return cg->rows;
+}
+
+/* ================================================================
+ * Text rendering (UTF-8, 8x16 cells)
  * ================================================================ */
 
-static void draw_char(Framebuffer *fb, int x, int y, char ch, uint32_t c,
+static void draw_char(Framebuffer *fb, int x, int y, uint32_t cp, uint32_t c,
                        int scale)
 {
-    int idx = (unsigned char)ch - 0x20;
-    if (idx < 0 || idx >= 95) return;
-    const uint8_t *glyph = font8x16[idx];
+    const uint8_t *glyph;
+    if (cp < 0x20 || cp == 0x7F) return;
+    glyph = cp < 0x7F ? font8x16[cp - 0x20] : font_glyph(cp);
     for (int row = 0; row < FONT_H; row++) {
         uint8_t bits = glyph[row];
         for (int col = 0; col < FONT_W; col++) {
@@ -487,15 +1164,21 @@ static void draw_text(Framebuffer *fb, int x, int y, const char *text,
                        uint32_t c, int scale)
 {
     while (*text) {
-        draw_char(fb, x, y, *text, c, scale);
+        draw_char(fb, x, y, utf8_next(&text), c, scale);
         x += FONT_W * scale;
-        text++;
     }
 }
 
+/* Decodes exactly as draw_text() does, so malformed bytes that are
+ * drawn as boxes are counted too */
 static int text_width(const char *text, int scale)
 {
-    return (int)strlen(text) * FONT_W * scale;
+    int n = 0;
+    while (*text) {
+        utf8_next(&text);
+        n++;
+    }
+    return n * FONT_W * scale;
 }
 
 static void draw_text_centered(Framebuffer *fb, int cx, int y, const char *text,
@@ -538,6 +1221,14 @@ static void build_guid(const struct input_id *id, char *guid_str)
  * Controller detection and input
  * ================================================================ */
 
+/* Queues of different devices are merged by event timestamp, so every
+ * device reports on the clock time_us() uses */
+static int evdev_clock_monotonic(int fd)
+{
+    int clk = CLOCK_MONOTONIC;
+    return ioctl(fd, EVIOCSCLOCKID, &clk) == 0;
+}
+
 static int is_gamepad(int fd)
 {
     unsigned long evbits[NBITS(EV_MAX)];
@@ -567,30 +1258,151 @@ static int is_gamepad(int fd)
     return 0;
 }
 
+/* ================================================================
+ * Axis calibration
+ * ================================================================ */
+
+static uint32_t isqrt32(uint32_t v)
+{
+    uint32_t r = 0, bit = 1u << 30;
+    while (bit > v) bit >>= 2;
+    while (bit) {
+        if (v >= r + bit) { v -= r + bit; r = (r >> 1) + bit; }
+        else r >>= 1;
+        bit >>= 2;
+    }
+    return r;
+}
+
+/* Centre, deadzone and press/release thresholds from the running stats.
+ * Runs every CALIB_DERIVE_EVERY rest samples, not per sample. */
+static void axis_calib_derive(AxisInfo *a)
+{
+    int32_t range = a->max - a->min;
+    float var = a->n > 1 ? a->m2 / (float)(a->n - 1) : 0.0f;
+    int32_t sigma = (int32_t)isqrt32(var < 4e9f ? (uint32_t)var : 4000000000u);
+
+    a->center = (int32_t)(a->mean + (a->mean < 0 ? -0.5f : 0.5f));
+    if (a->center < a->min) a->center = a->min;
+    if (a->center > a->max) a->center = a->max;
+
+    int32_t dz = CALIB_NOISE_SIGMAS * sigma;
+    if (dz < a->flat) dz = a->flat;
+    if (dz < range / 20) dz = range / 20;
+    if (dz < 1) dz = 1;
+    a->deadzone = dz;
+
+    /* 40% of the range as before, but measured from the real rest point
+     * and never more than 80% of the travel available from it */
+    int32_t travel = a->max - a->center;
+    if (a->center - a->min > travel) travel = a->center - a->min;
+    int32_t on = range * 2 / 5;
+    if (on > travel * 4 / 5) on = travel * 4 / 5;
+    if (on < 2 * dz) on = 2 * dz;
+    a->thresh = on;
+    a->thresh_off = on - (on - dz) / 4;
+
+    int32_t win = 6 * sigma;
+    if (win < range / 16) win = range / 16;
+    if (win < dz) win = dz;
+    a->rest_window = win;
+}
+
+/* Restart the estimate at v */
+static void axis_calib_seed(AxisInfo *a, int32_t v)
+{
+    a->n = 1;
+    a->mean = (float)v;
+    a->m2 = 0.0f;
+    a->stray = 0;
+    axis_calib_derive(a);
+}
+
+/* Seed from the kernel's current value, which is the rest position when
+ * the pad is idle - including triggers that rest at one extreme. A value
+ * that is neither near the middle nor near an end is a stick being held
+ * over, so the middle is the better guess. */
+static void axis_calib_init(AxisInfo *a, const struct input_absinfo *ai)
+{
+    memset(a, 0, sizeof(*a));
+    a->min = ai->minimum;
+    a->max = ai->maximum;
+    a->flat = ai->flat;
+    int32_t v = ai->value, mid = a->min + (a->max - a->min) / 2;
+    int32_t near = (a->max - a->min) / 8;
+    if (v < a->min || v > a->max ||
+        (abs(v - mid) > near && v - a->min > near && a->max - v > near))
+        v = mid;
+    a->obs_min = a->obs_max = v;
+    axis_calib_seed(a, v);
+}
+
+/* O(1) per sample: extremes always, Welford update only near rest. The
+ * sample count saturates so the estimate keeps tracking slow drift. */
+static inline void axis_calib_sample(AxisInfo *a, int32_t v)
+{
+    if (v < a->obs_min) a->obs_min = v;
+    if (v > a->obs_max) a->obs_max = v;
+    float d = (float)v - a->mean;
+    if (d > (float)a->rest_window || d < -(float)a->rest_window) {
+        /* A run of samples that agree with each other but not with the
+         * seed means it was taken off the rest point: move it. Only
+         * before the first rest sample, and only to the middle of the
+         * range, so a stick held over never drags the centre along. */
+        if (a->n > 1) return;
+        float ds = (float)v - a->stray_mean;
+        if (a->stray == 0 || ds > (float)a->rest_window ||
+            ds < -(float)a->rest_window) {
+            a->stray = 1;
+            a->stray_mean = (float)v;
+        } else if (++a->stray < CALIB_RESEED_RUN) {
+            a->stray_mean += ds / (float)a->stray;
+        } else {
+            int32_t mid = a->min + (a->max - a->min) / 2;
+            int32_t c = (int32_t)a->stray_mean;
+            if (abs(c - mid) <= (a->max - a->min) / 8)
+                axis_calib_seed(a, c);
+            else
+                a->stray = 0;
+        }
+        return;
+    }
+    a->stray = 0;
+    if (a->n < CALIB_MAX_SAMPLES) a->n++;
+    a->mean += d / (float)a->n;
+    a->m2 += d * ((float)v - a->mean);
+    if (a->n >= CALIB_MAX_SAMPLES)
+        a->m2 -= a->m2 / (float)CALIB_MAX_SAMPLES;
+    if ((a->n & (CALIB_DERIVE_EVERY - 1)) == 0 || a->n >= CALIB_MAX_SAMPLES)
+        axis_calib_derive(a);
+}
+
 static void enumerate_buttons_axes(Controller *c)
 {
     unsigned long keybits[NBITS(KEY_MAX)];
     unsigned long absbits[NBITS(ABS_MAX)];
     struct input_absinfo absinfo;
 
+    c->probed = 1;
     c->num_buttons = 0;
     c->num_axes = 0;
     c->num_hats = 0;
     memset(c->btn_map, 0xFF, sizeof(c->btn_map));  /* -1 */
     memset(c->abs_map, 0xFF, sizeof(c->abs_map));
     memset(c->hat_map, 0xFF, sizeof(c->hat_map));
-    memset(c->axis_initial, 0, sizeof(c->axis_initial));
+    memset(c->axes, 0, sizeof(c->axes));
 
-    /* Buttons: SDL2 order - BTN_JOYSTICK..KEY_MAX, then BTN_MISC..BTN_JOYSTICK-1 */
+    /* Buttons: SDL2 order - BTN_JOYSTICK..KEY_MAX, then BTN_MISC..BTN_JOYSTICK-1.
+     * Indices are int8_t; no real pad comes near 127 buttons. */
     memset(keybits, 0, sizeof(keybits));
     ioctl(c->fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits);
 
-    for (int i = BTN_JOYSTICK; i < KEY_MAX; i++)
+    for (int i = BTN_JOYSTICK; i < KEY_MAX && c->num_buttons < INT8_MAX; i++)
         if (TEST_BIT(i, keybits))
-            c->btn_map[i] = c->num_buttons++;
-    for (int i = BTN_MISC; i < BTN_JOYSTICK; i++)
+            c->btn_map[i - BTN_MISC] = c->num_buttons++;
+    for (int i = BTN_MISC; i < BTN_JOYSTICK && c->num_buttons < INT8_MAX; i++)
         if (TEST_BIT(i, keybits))
-            c->btn_map[i] = c->num_buttons++;
+            c->btn_map[i - BTN_MISC] = c->num_buttons++;
 
     /* Axes: sequential, skip HAT range */
     memset(absbits, 0, sizeof(absbits));
@@ -599,125 +1411,526 @@ static void enumerate_buttons_axes(Controller *c)
     for (int i = 0; i < ABS_MAX; i++) {
         if (!TEST_BIT(i, absbits)) continue;
 
+        if (i >= ABS_HAT0X && i <= ABS_HAT3Y) {
+            c->hat_map[i - ABS_HAT0X] = (i - ABS_HAT0X) / 2;
+            if ((i - ABS_HAT0X) / 2 >= c->num_hats)
+                c->num_hats = (i - ABS_HAT0X) / 2 + 1;
+            continue;
+        }
+        if (c->num_axes >= MAX_AXES) continue;
+
         memset(&absinfo, 0, sizeof(absinfo));
         ioctl(c->fd, EVIOCGABS(i), &absinfo);
-        c->axis_min[i] = absinfo.minimum;
-        c->axis_max[i] = absinfo.maximum;
-        /* Use midpoint of range as center for axes where initial value
-         * might be at the extreme (e.g. triggers starting at 0) */
-        c->axis_initial[i] = (absinfo.minimum + absinfo.maximum) / 2;
 
-        if (i >= ABS_HAT0X && i <= ABS_HAT3Y) {
-            c->hat_map[i] = (i - ABS_HAT0X) / 2;
-            if (c->hat_map[i] >= c->num_hats)
-                c->num_hats = c->hat_map[i] + 1;
-        } else {
-            c->abs_map[i] = c->num_axes++;
-        }
+        axis_calib_init(&c->axes[c->num_axes], &absinfo);
+        c->abs_map[i] = c->num_axes++;
     }
 }
 
-static void scan_controllers(App *app)
+/* Button index for a key code, or -1 */
+static inline int ctrl_button(const Controller *c, unsigned code)
 {
-    DIR *dir;
-    struct dirent *entry;
-    char path[MAX_PATH_LEN];
+    if (code < BTN_MISC || code > KEY_MAX) return -1;
+    return c->btn_map[code - BTN_MISC];
+}
 
-    /* close previously opened fds */
-    for (int i = 0; i < app->num_controllers; i++)
-        if (app->controllers[i].fd >= 0)
-            close(app->controllers[i].fd);
-    app->num_controllers = 0;
+/* Axis index for an abs code, or -1 (hats are not axes) */
+static inline int ctrl_axis(const Controller *c, unsigned code)
+{
+    return code <= ABS_MAX ? c->abs_map[code] : -1;
+}
 
-    dir = opendir("/dev/input");
-    if (!dir) return;
+/* Hat index for an abs code, or -1 */
+static inline int ctrl_hat(const Controller *c, unsigned code)
+{
+    if (code < ABS_HAT0X || code > ABS_HAT3Y) return -1;
+    return c->hat_map[code - ABS_HAT0X];
+}
 
-    while ((entry = readdir(dir)) != NULL) {
-        if (app->num_controllers >= MAX_CONTROLLERS) break;
-        if (strlen(entry->d_name) <= 5) continue;
-        if (strncmp(entry->d_name, "event", 5) != 0) continue;
+/* -1, 0 or 1 for an axis value, with hysteresis: a direction is entered
+ * past thresh and held until the value falls back inside thresh_off */
+static inline int ctrl_axis_dir(Controller *c, int axis, int value)
+{
+    AxisInfo *a = &c->axes[axis];
+    int delta = value - a->center;
+    int dir;
+    if (a->state > 0 && delta > a->thresh_off) dir = 1;
+    else if (a->state < 0 && delta < -a->thresh_off) dir = -1;
+    else dir = delta > a->thresh ? 1 : delta < -a->thresh ? -1 : 0;
+    a->state = (int8_t)dir;
+    return dir;
+}
 
-        snprintf(path, sizeof(path), "/dev/input/%s", entry->d_name);
-        int fd = open(path, O_RDONLY | O_NONBLOCK);
-        if (fd < 0) continue;
+/* Axis index for an EV_ABS event, feeding the value to the calibrator */
+static inline int ctrl_axis_sample(Controller *c, unsigned code, int value)
+{
+    int axis = ctrl_axis(c, code);
+    if (axis >= 0) axis_calib_sample(&c->axes[axis], value);
+    return axis;
+}
 
-        if (!is_gamepad(fd)) { close(fd); continue; }
+/* Open one event node as a controller. Returns -1 if it cannot be opened
+ * or is not a gamepad. */
+static int open_controller(Controller *c, const char *path)
+{
+    int fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) return -1;
 
-        Controller *c = &app->controllers[app->num_controllers];
-        memset(c, 0, sizeof(*c));
-        c->fd = fd;
-        snprintf(c->path, sizeof(c->path), "%s", path);
+    if (!is_gamepad(fd)) { close(fd); return -1; }
 
-        if (ioctl(fd, EVIOCGID, &c->id) < 0) { close(fd); continue; }
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    snprintf(c->path, sizeof(c->path), "%s", path);
 
-        memset(c->name, 0, sizeof(c->name));
-        if (ioctl(fd, EVIOCGNAME(sizeof(c->name) - 1), c->name) < 0)
-            strcpy(c->name, "Unknown Controller");
+    if (ioctl(fd, EVIOCGID, &c->id) < 0) { close(fd); return -1; }
+
+    memset(c->name, 0, sizeof(c->name));
+    if (ioctl(fd, EVIOCGNAME(sizeof(c->name) - 1), c->name) < 0)
+        strcpy(c->name, "Unknown Controller");
+
+    build_guid(&c->id, c->guid);
+    c->mono_clock = evdev_clock_monotonic(fd);
+    return 0;
+}
 
-        build_guid(&c->id, c->guid);
+/* Query button/axis layout; deferred until a controller is selected,
+ * since the detect screen only needs key presses */
+static void probe_controller(Controller *c)
+{
+    if (!c->probed)
         enumerate_buttons_axes(c);
-        app->num_controllers++;
-    }
-    closedir(dir);
 }
 
-static void close_controllers(App *app)
+/* ================================================================
+ * Event merge
+ *
+ * A k-way merge of the queues of several devices by kernel timestamp,
+ * so that when two devices are used close together the one used first
+ * is handled first, whatever its index. A source is refilled when its
+ * buffer runs out, so all events queued at the start of a pass come
+ * out in order. The cost is one read() per MERGE_BATCH events plus
+ * O(log k) per event, and the evdev client buffers bound how much can
+ * be queued.
+ *
+ * A caller may stop a pass early: what it has not taken stays buffered
+ * and comes out first the next time that device is added. Drained or
+ * closed devices must be dropped with merge_forget().
+ * ================================================================ */
+
+static uint64_t event_time_us(const struct input_event *ev)
 {
-    for (int i = 0; i < app->num_controllers; i++)
-        if (app->controllers[i].fd >= 0)
-            close(app->controllers[i].fd);
-    app->num_controllers = 0;
+#ifdef input_event_sec
+    return (uint64_t)ev->input_event_sec * 1000000 + ev->input_event_usec;
+#else
+    return (uint64_t)ev->time.tv_sec * 1000000 + ev->time.tv_usec;
+#endif
 }
 
-static void drain_events(int fd)
+static void set_event_time_us(struct input_event *ev, uint64_t us)
 {
-    struct input_event ev;
-    while (read(fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev))
-        ;
+#ifdef input_event_sec
+    ev->input_event_sec = us / 1000000;
+    ev->input_event_usec = us % 1000000;
+#else
+    ev->time.tv_sec = us / 1000000;
+    ev->time.tv_usec = us % 1000000;
+#endif
 }
 
-static void drain_nav_events(App *app)
+/* Heap order: earlier timestamp first, lower source index on ties */
+static int merge_before(const EventMerge *m, int a, int b)
 {
-    drain_events(app->controllers[app->sel_ctrl].fd);
-    if (app->thec64_nav_idx >= 0)
-        drain_events(app->controllers[app->thec64_nav_idx].fd);
+    const MergeSource *sa = &m->src[a], *sb = &m->src[b];
+    uint64_t ta = event_time_us(&sa->buf[sa->pos]);
+    uint64_t tb = event_time_us(&sb->buf[sb->pos]);
+    return ta != tb ? ta < tb : a < b;
 }
 
-/* ================================================================
- * THEJOYSTICK detection
- * ================================================================ */
+static void merge_sift_down(EventMerge *m, int i)
+{
+    for (;;) {
+        int l = 2 * i + 1, min = i;
+        if (l < m->num_heap && merge_before(m, m->heap[l], m->heap[min]))
+            min = l;
+        if (l + 1 < m->num_heap && merge_before(m, m->heap[l + 1], m->heap[min]))
+            min = l + 1;
+        if (min == i) return;
+        uint8_t tmp = m->heap[i];
+        m->heap[i] = m->heap[min];
+        m->heap[min] = tmp;
+        i = min;
+    }
+}
 
-static int is_thec64_joystick(Controller *c)
+static void merge_sift_up(EventMerge *m, int i)
 {
-    if (strstr(c->name, "THEC64 Joystick") != NULL)
-        return 1;
-    if (strcmp(c->guid, "03000000591c00002300000010010000") == 0)
-        return 1;
-    if (strcmp(c->guid, "03000000591c00002400000010010000") == 0)
-        return 1;
-    return 0;
+    while (i > 0 && merge_before(m, m->heap[i], m->heap[(i - 1) / 2])) {
+        uint8_t tmp = m->heap[i];
+        m->heap[i] = m->heap[(i - 1) / 2];
+        m->heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
 }
 
-/* Find THEJOYSTICK among detected controllers (excluding selected one) */
-static void find_thec64_nav(App *app)
+/* A device whose clock could not be switched (evdev_clock_monotonic)
+ * still stamps CLOCK_REALTIME. Stamps nearer the realtime clock than
+ * the monotonic one are moved onto the monotonic clock, so they compare
+ * with everyone else's. */
+static int merge_refill(MergeSource *s)
 {
-    app->thec64_nav_idx = -1;
-    for (int i = 0; i < app->num_controllers; i++) {
-        if (i == app->sel_ctrl) continue;
-        if (is_thec64_joystick(&app->controllers[i])) {
-            app->thec64_nav_idx = i;
-            return;
-        }
+    ssize_t n = read(s->fd, s->buf, sizeof(s->buf));
+    s->pos = 0;
+    s->len = n > 0 ? n / (ssize_t)sizeof(struct input_event) : 0;
+    if (s->len == 0) return 0;
+
+    struct timespec rt;
+    clock_gettime(CLOCK_REALTIME, &rt);
+    uint64_t mono = time_us();
+    uint64_t real = (uint64_t)rt.tv_sec * 1000000 + rt.tv_nsec / 1000;
+    for (int i = 0; i < s->len; i++) {
+        uint64_t t = event_time_us(&s->buf[i]);
+        uint64_t dm = t > mono ? t - mono : mono - t;
+        uint64_t dr = t > real ? t - real : real - t;
+        if (dr < dm)
+            set_event_time_us(&s->buf[i], t - real + mono);
     }
+    return s->len;
 }
 
-/* Read THEJOYSTICK navigation input using hardcoded mappings:
+static void merge_activate(EventMerge *m, int i)
+{
+    if (m->src[i].active) return;
+    m->src[i].active = 1;
+    m->heap[m->num_heap] = i;
+    merge_sift_up(m, m->num_heap++);
+}
+
+/* Start a pass: sources with nothing buffered are let go, the rest
+ * wait to be added again */
+static void merge_begin(EventMerge *m)
+{
+    int n = 0;
+    for (int i = 0; i < m->num_src; i++) {
+        if (m->src[i].pos == m->src[i].len) continue;
+        if (n != i) m->src[n] = m->src[i];
+        m->src[n++].active = 0;
+    }
+    m->num_src = n;
+    m->num_heap = 0;
+}
+
+static void merge_add_group(EventMerge *m, int fd, int group)
+{
+    for (int i = 0; i < m->num_src; i++) {
+        if (m->src[i].fd != fd) continue;
+        if (group >= 0) m->src[i].group = group;
+        /* what is buffered is older than anything still in the kernel */
+        if (m->src[i].pos < m->src[i].len || merge_refill(&m->src[i]))
+            merge_activate(m, i);
+        return;
+    }
+    if (m->num_src == MERGE_SOURCES) return;
+    MergeSource *s = &m->src[m->num_src];
+    s->fd = fd;
+    s->group = group;
+    s->active = 0;
+    if (!merge_refill(s)) return;
+    merge_activate(m, m->num_src++);
+}
+
+/* Add a device to the pass; nothing happens if it has no events */
+static void merge_add(EventMerge *m, int fd)
+{
+    merge_add_group(m, fd, -1);
+}
+
+/* Add every fd of an epoll set that has input, and every one found
+ * through it earlier that still has events buffered */
+static void merge_add_ready(EventMerge *m, int epfd)
+{
+    struct epoll_event ready[READY_EVENTS];
+
+    for (int i = 0; i < m->num_src; i++)
+        if (m->src[i].group == epfd && m->src[i].pos < m->src[i].len)
+            merge_activate(m, i);
+    int n = epoll_wait(epfd, ready, READY_EVENTS, 0);
+    for (int i = 0; i < n; i++)
+        merge_add_group(m, ready[i].data.fd, epfd);
+}
+
+/* Drop what is buffered for fd, when its queue is drained or closed */
+static void merge_forget(EventMerge *m, int fd)
+{
+    for (int i = 0; i < m->num_src; i++) {
+        MergeSource *s = &m->src[i];
+        if (s->fd != fd) continue;
+        s->pos = s->len = 0;
+        s->fd = -1;
+        if (!s->active) return;
+        s->active = 0;
+        for (int k = 0; k < m->num_heap; k++) {
+            if (m->heap[k] != i) continue;
+            m->heap[k] = m->heap[--m->num_heap];
+            if (k < m->num_heap) {
+                merge_sift_down(m, k);
+                merge_sift_up(m, k);
+            }
+            return;
+        }
+    }
+}
+
+/* The oldest pending event of the pass and its device, without taking
+ * it; NULL once every source is empty */
+static const struct input_event *merge_peek(const EventMerge *m, int *fd)
+{
+    if (m->num_heap == 0) return NULL;
+    const MergeSource *s = &m->src[m->heap[0]];
+    *fd = s->fd;
+    return &s->buf[s->pos];
+}
+
+/* Take the oldest pending event. Returns 0 once every source is empty. */
+static int merge_next(EventMerge *m, struct input_event *ev, int *fd)
+{
+    if (m->num_heap == 0) return 0;
+    MergeSource *s = &m->src[m->heap[0]];
+    *ev = s->buf[s->pos++];
+    *fd = s->fd;
+    if (s->pos == s->len && !merge_refill(s)) {
+        s->active = 0;
+        m->heap[0] = m->heap[--m->num_heap];
+    }
+    merge_sift_down(m, 0);
+    return 1;
+}
+
+/* ================================================================
+ * Device registry
+ * ================================================================ */
+
+static int registry_init(App *app)
+{
+    app->ctrl_epfd = epoll_create1(EPOLL_CLOEXEC);
+    app->kbd_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (app->ctrl_epfd < 0 || app->kbd_epfd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+    return 0;
+}
+
+/* Grow the controller array to hold at least n entries. Indices stay
+ * valid; pointers into the array do not survive a call. */
+static int ctrl_reserve(App *app, int n)
+{
+    if (n <= app->cap_controllers) return 0;
+    int cap = app->cap_controllers ? app->cap_controllers * 2 : 8;
+    while (cap < n) cap *= 2;
+    Controller *c = realloc(app->controllers, cap * sizeof(Controller));
+    if (!c) return -1;
+    app->controllers = c;
+    app->cap_controllers = cap;
+    return 0;
+}
+
+static int fd_slot_set(App *app, int fd, int32_t slot)
+{
+    if (fd >= app->fd_slot_cap) {
+        int cap = app->fd_slot_cap ? app->fd_slot_cap : 64;
+        while (cap <= fd) cap *= 2;
+        int32_t *m = realloc(app->fd_slot, cap * sizeof(int32_t));
+        if (!m) return -1;
+        memset(m + app->fd_slot_cap, 0xFF,
+               (cap - app->fd_slot_cap) * sizeof(int32_t));  /* -1 */
+        app->fd_slot = m;
+        app->fd_slot_cap = cap;
+    }
+    app->fd_slot[fd] = slot;
+    return 0;
+}
+
+/* Controller index for an open fd, or -1 */
+static inline int ctrl_slot(const App *app, int fd)
+{
+    return fd >= 0 && fd < app->fd_slot_cap ? app->fd_slot[fd] : -1;
+}
+
+/* Make controllers[idx] visible to readiness dispatch */
+static int ctrl_register(App *app, int idx)
+{
+    int fd = app->controllers[idx].fd;
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    if (fd_slot_set(app, fd, idx) < 0) return -1;
+    if (epoll_ctl(app->ctrl_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        app->fd_slot[fd] = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* Close controllers[idx] and close the gap, keeping list order */
+/* Index i after controller idx is removed; -1 if i was idx */
+static int ctrl_index_after_remove(int i, int idx)
+{
+    return i == idx ? -1 : i > idx ? i - 1 : i;
+}
+
+static void ctrl_remove(App *app, int idx)
+{
+    int fd = app->controllers[idx].fd;
+    if (ctrl_slot(app, fd) == idx) {
+        epoll_ctl(app->ctrl_epfd, EPOLL_CTL_DEL, fd, NULL);
+        app->fd_slot[fd] = -1;
+    }
+    merge_forget(&app->merge, fd);
+    close(fd);
+    app->num_controllers--;
+    memmove(&app->controllers[idx], &app->controllers[idx + 1],
+            (app->num_controllers - idx) * sizeof(Controller));
+    for (int i = idx; i < app->num_controllers; i++)
+        if (ctrl_slot(app, app->controllers[i].fd) == i + 1)
+            app->fd_slot[app->controllers[i].fd] = i;
+    app->detect_active = ctrl_index_after_remove(app->detect_active, idx);
+    app->sel_ctrl = ctrl_index_after_remove(app->sel_ctrl, idx);
+    app->thec64_nav_idx = ctrl_index_after_remove(app->thec64_nav_idx, idx);
+}
+
+static int ctrl_find_path(const App *app, const char *path)
+{
+    for (int i = 0; i < app->num_controllers; i++)
+        if (strcmp(app->controllers[i].path, path) == 0)
+            return i;
+    return -1;
+}
+
+/* Drop controllers that went away and add new ones. Devices that are
+ * still present stay open, keeping their probed tables and calibration. */
+static void scan_controllers(App *app)
+{
+    DIR *dir;
+    struct dirent *entry;
+    char path[MAX_PATH_LEN];
+    struct input_id id;
+
+    for (int i = app->num_controllers - 1; i >= 0; i--)
+        if (ioctl(app->controllers[i].fd, EVIOCGID, &id) < 0)
+            ctrl_remove(app, i);  /* ENODEV once unplugged */
+
+    dir = opendir("/dev/input");
+    if (!dir) return;
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (strlen(entry->d_name) <= 5) continue;
+        if (strncmp(entry->d_name, "event", 5) != 0) continue;
+
+        snprintf(path, sizeof(path), "/dev/input/%s", entry->d_name);
+        if (ctrl_find_path(app, path) >= 0) continue;
+        if (ctrl_reserve(app, app->num_controllers + 1) < 0) break;
+
+        Controller *c = &app->controllers[app->num_controllers];
+        if (open_controller(c, path) < 0)
+            continue;
+        if (ctrl_register(app, app->num_controllers) < 0) {
+            close(c->fd);
+            continue;
+        }
+        app->num_controllers++;
+    }
+    closedir(dir);
+}
+
+static void close_controllers(App *app)
+{
+    while (app->num_controllers > 0)
+        ctrl_remove(app, app->num_controllers - 1);
+}
+
+/* Discard pending input. Axis hysteresis starts over too, so a
+ * direction held before the drain is not carried past it. */
+static void drain_events(App *app, Controller *c)
+{
+    struct input_event ev;
+    merge_forget(&app->merge, c->fd);
+    while (read(c->fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev))
+        ;
+    for (int i = 0; i < c->num_axes; i++)
+        c->axes[i].state = 0;
+}
+
+static void drain_nav_events(App *app)
+{
+    drain_events(app, &app->controllers[app->sel_ctrl]);
+    if (app->thec64_nav_idx >= 0)
+        drain_events(app, &app->controllers[app->thec64_nav_idx]);
+}
+
+/* ================================================================
+ * THEJOYSTICK detection
+ * ================================================================ */
+
+static int is_thec64_joystick(Controller *c)
+{
+    if (strstr(c->name, "THEC64 Joystick") != NULL)
+        return 1;
+    if (strcmp(c->guid, "03000000591c00002300000010010000") == 0)
+        return 1;
+    if (strcmp(c->guid, "03000000591c00002400000010010000") == 0)
+        return 1;
+    return 0;
+}
+
+/* Find THEJOYSTICK among detected controllers (excluding selected one) */
+static void find_thec64_nav(App *app)
+{
+    app->thec64_nav_idx = -1;
+    for (int i = 0; i < app->num_controllers; i++) {
+        if (i == app->sel_ctrl) continue;
+        if (is_thec64_joystick(&app->controllers[i])) {
+            app->thec64_nav_idx = i;
+            return;
+        }
+    }
+}
+
+/* Read THEJOYSTICK navigation input using hardcoded mappings:
  *   ABS_X (0-255, center 127) → dx
  *   ABS_Y (0-255, center 127) → dy
  *   BTN_TRIGGER (288) / BTN_TOP2 (292) → btn_a (Left Fire / Menu 1)
  *   BTN_PINKIE  (293) → btn_b (Menu 2)
  *   BTN_BASE2   (295) → btn_start (Menu 4)
  */
+static int thec64_nav_event(const struct input_event *ev, int *dy, int *dx,
+                            int *btn_a, int *btn_b, int *btn_start)
+{
+    int got = 0;
+
+    if (ev->type == EV_KEY && ev->value == 1) {
+        if (ev->code == BTN_TRIGGER || ev->code == BTN_TOP2)
+            { *btn_a = 1; got = 1; }
+        else if (ev->code == BTN_PINKIE)
+            { *btn_b = 1; got = 1; }
+        else if (ev->code == BTN_BASE2)
+            { *btn_start = 1; got = 1; }
+    }
+    else if (ev->type == EV_ABS) {
+        /* ABS_Y → dy, ABS_X → dx  (range 0-255, center ~127) */
+        int delta = ev->value - 127;
+        int thresh = 50; /* ~40% of half-range (127) */
+        if (ev->code == ABS_Y) {
+            if (delta < -thresh) { *dy = -1; got = 1; }
+            else if (delta > thresh) { *dy = 1; got = 1; }
+            else *dy = 0;
+        }
+        if (ev->code == ABS_X) {
+            if (delta < -thresh) { *dx = -1; got = 1; }
+            else if (delta > thresh) { *dx = 1; got = 1; }
+            else *dx = 0;
+        }
+    }
+    return got;
+}
+
 static int read_thec64_nav(App *app, int *dy, int *dx,
                            int *btn_a, int *btn_b, int *btn_start)
 {
@@ -726,31 +1939,8 @@ static int read_thec64_nav(App *app, int *dy, int *dx,
     struct input_event ev;
     int got = 0;
 
-    while (read(c->fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
-        if (ev.type == EV_KEY && ev.value == 1) {
-            if (ev.code == BTN_TRIGGER || ev.code == BTN_TOP2)
-                { *btn_a = 1; got = 1; }
-            else if (ev.code == BTN_PINKIE)
-                { *btn_b = 1; got = 1; }
-            else if (ev.code == BTN_BASE2)
-                { *btn_start = 1; got = 1; }
-        }
-        else if (ev.type == EV_ABS) {
-            /* ABS_Y → dy, ABS_X → dx  (range 0-255, center ~127) */
-            int delta = ev.value - 127;
-            int thresh = 50; /* ~40% of half-range (127) */
-            if (ev.code == ABS_Y) {
-                if (delta < -thresh) { *dy = -1; got = 1; }
-                else if (delta > thresh) { *dy = 1; got = 1; }
-                else *dy = 0;
-            }
-            if (ev.code == ABS_X) {
-                if (delta < -thresh) { *dx = -1; got = 1; }
-                else if (delta > thresh) { *dx = 1; got = 1; }
-                else *dx = 0;
-            }
-        }
-    }
+    while (read(c->fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev))
+        got |= thec64_nav_event(&ev, dy, dx, btn_a, btn_b, btn_start);
     return got;
 }
 
@@ -789,7 +1979,6 @@ static void scan_keyboards(App *app)
     if (!dir) return;
 
     while ((entry = readdir(dir)) != NULL) {
-        if (app->num_kbd_fds >= 8) break;
         if (strlen(entry->d_name) <= 5) continue;
         if (strncmp(entry->d_name, "event", 5) != 0) continue;
 
@@ -797,31 +1986,53 @@ static void scan_keyboards(App *app)
         int fd = open(path, O_RDONLY | O_NONBLOCK);
         if (fd < 0) continue;
 
-        if (is_keyboard(fd)) {
-            app->kbd_fds[app->num_kbd_fds++] = fd;
-        } else {
+        if (!is_keyboard(fd)) {
+            close(fd);
+            continue;
+        }
+        evdev_clock_monotonic(fd);
+        if (app->num_kbd_fds == app->cap_kbd_fds) {
+            int cap = app->cap_kbd_fds ? app->cap_kbd_fds * 2 : 8;
+            int *fds = realloc(app->kbd_fds, cap * sizeof(int));
+            if (!fds) { close(fd); break; }
+            app->kbd_fds = fds;
+            app->cap_kbd_fds = cap;
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+        if (epoll_ctl(app->kbd_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
             close(fd);
+            continue;
         }
+        app->kbd_fds[app->num_kbd_fds++] = fd;
     }
     closedir(dir);
 }
 
 static void close_keyboards(App *app)
 {
-    for (int i = 0; i < app->num_kbd_fds; i++)
-        close(app->kbd_fds[i]);
+    for (int i = 0; i < app->num_kbd_fds; i++) {
+        merge_forget(&app->merge, app->kbd_fds[i]);
+        close(app->kbd_fds[i]);  /* also leaves the epoll set */
+    }
     app->num_kbd_fds = 0;
+    free(app->kbd_fds);
+    app->kbd_fds = NULL;
+    app->cap_kbd_fds = 0;
 }
 
-/* Read keyboard events, return key code of pressed key (0 if none) */
+/* Read keyboard events, return key code of the first key pressed on
+ * any keyboard (0 if none). Only keyboards with pending input are read;
+ * later presses stay buffered for the next call. */
 static int read_keyboard(App *app)
 {
     struct input_event ev;
-    for (int i = 0; i < app->num_kbd_fds; i++) {
-        while (read(app->kbd_fds[i], &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
-            if (ev.type == EV_KEY && ev.value == 1)
-                return ev.code;
-        }
+    int fd;
+
+    merge_begin(&app->merge);
+    merge_add_ready(&app->merge, app->kbd_epfd);
+    while (merge_next(&app->merge, &ev, &fd)) {
+        if (ev.type == EV_KEY && ev.value == 1)
+            return ev.code;
     }
     return 0;
 }
@@ -888,965 +2099,3331 @@ static void build_mapping_string(App *app, char *out, size_t sz)
     (void)pos;
 }
 
-/* ================================================================
- * Draw THEJOYSTICK graphic
- * ================================================================ */
-
-/* joystick element bounding boxes (relative to origin) */
-#define JOY_W  600
-#define JOY_H  300
+/* Format a single mapping value as it appears in the mapping string
+ * ("b3", "a1", "h0.4"), or "" when unmapped. */
+static void format_mapping_value(const MappingEntry *m, char *out, size_t sz)
+{
+    switch (m->mapped_type) {
+    case MAP_BUTTON: snprintf(out, sz, "b%d", m->mapped_index); break;
+    case MAP_AXIS:   snprintf(out, sz, "a%d", m->mapped_index); break;
+    case MAP_HAT:
+        snprintf(out, sz, "h%d.%d", m->mapped_index, m->hat_mask);
+        break;
+    default:         snprintf(out, sz, "%s", ""); break;
+    }
+}
 
-/* Element colour based on mapping state */
-static uint32_t elem_color(App *app, int idx, uint32_t normal)
+/* Parse a mapping value ("b3", "a1", "h0.4") into an entry */
+static int parse_mapping_value(const char *s, MappingEntry *m)
 {
-    if (app->state == STATE_MAPPING && app->cur_map == idx && app->blink)
-        return COL_HIGHLIGHT;
-    if (app->mappings[idx].mapped_type != MAP_NONE)
-        return COL_MAPPED;
-    return normal;
+    int idx, mask;
+    if (s[0] == 'b' && sscanf(s + 1, "%d", &idx) == 1 && idx >= 0) {
+        m->mapped_type = MAP_BUTTON;
+        m->mapped_index = idx;
+        return 0;
+    }
+    if (s[0] == 'a' && sscanf(s + 1, "%d", &idx) == 1 && idx >= 0) {
+        m->mapped_type = MAP_AXIS;
+        m->mapped_index = idx;
+        return 0;
+    }
+    if (s[0] == 'h' && sscanf(s + 1, "%d.%d", &idx, &mask) == 2 &&
+        idx >= 0 && (mask == 1 || mask == 2 || mask == 4 || mask == 8)) {
+        m->mapped_type = MAP_HAT;
+        m->mapped_index = idx;
+        m->hat_mask = mask;
+        return 0;
+    }
+    return -1;
 }
 
-/* Colour for the stick (shared by leftx=8 and lefty=9) */
-static uint32_t stick_color(App *app)
+/* Look up a mapping entry by its gamecontrollerdb name */
+static int find_mapping(const MappingEntry *m, const char *gcdb_name)
 {
-    if (app->state == STATE_MAPPING &&
-        (app->cur_map == 8 || app->cur_map == 9) && app->blink)
-        return COL_HIGHLIGHT;
-    if (app->mappings[8].mapped_type != MAP_NONE &&
-        app->mappings[9].mapped_type != MAP_NONE)
-        return COL_MAPPED;
-    if (app->mappings[8].mapped_type != MAP_NONE ||
-        app->mappings[9].mapped_type != MAP_NONE)
-        return 0xFF66AA44;  /* partial = yellow-green */
-    return COL_STICK_TOP;
+    for (int i = 0; i < NUM_MAPPINGS; i++)
+        if (strcmp(m[i].gcdb_name, gcdb_name) == 0)
+            return i;
+    return -1;
 }
 
-static void draw_joystick(Framebuffer *fb, App *app, int ox, int oy)
+/* ================================================================
+ * Review model
+ * ================================================================ */
+
+/* Call after any MappingEntry (or the selected controller) changes */
+static void mappings_changed(App *app)
 {
-    /* Body shadow */
-    draw_rounded_rect(fb, ox + 33, oy + 53, 540, 180, 20, COL_BODY_DARK);
-    /* Body */
-    draw_rounded_rect(fb, ox + 30, oy + 50, 540, 180, 20, COL_BODY);
+    app->review.version++;
+}
 
-    /* Left fire button */
-    draw_rounded_rect(fb, ox + 38, oy + 100, 108, 40, 10,
-                       elem_color(app, 0, COL_BTN_FIRE));
-    draw_text_centered(fb, ox + 92, oy + 108, "L.Fire", COL_TEXT, 1);
+static int mappings_equal(const MappingEntry *a, const MappingEntry *b)
+{
+    return a->mapped_type == b->mapped_type &&
+           a->mapped_index == b->mapped_index &&
+           (a->mapped_type != MAP_HAT || a->hat_mask == b->hat_mask);
+}
 
-    /* Right fire button */
-    draw_rounded_rect(fb, ox + 454, oy + 100, 108, 40, 10,
-                       elem_color(app, 1, COL_BTN_FIRE));
-    draw_text_centered(fb, ox + 508, oy + 108, "R.Fire", COL_TEXT, 1);
+/* Rebuild row strings, duplicate sets and app->mapping_str if stale */
+static void review_model_update(App *app)
+{
+    ReviewModel *rm = &app->review;
+    char val[32];
 
-    /* Stick base circle */
-    draw_circle(fb, ox + 220, oy + 135, 50, COL_STICK_BASE);
-    /* Stick shaft */
-    draw_rect(fb, ox + 213, oy + 60, 14, 75, COL_STICK);
-    /* Stick ball */
-    draw_circle(fb, ox + 220, oy + 55, 22, stick_color(app));
+    if (rm->built_version == rm->version)
+        return;
 
-    /* Stick direction labels */
-    if (app->state == STATE_MAPPING && app->cur_map == 8) {
-        /* leftx: show L/R arrows */
-        draw_text(fb, ox + 155, oy + 48, "<", COL_HIGHLIGHT, 2);
-        draw_text(fb, ox + 262, oy + 48, ">", COL_HIGHLIGHT, 2);
-    }
-    if (app->state == STATE_MAPPING && app->cur_map == 9) {
-        /* lefty: show U/D arrows */
-        draw_text_centered(fb, ox + 220, oy + 15, "^", COL_HIGHLIGHT, 2);
-        draw_text_centered(fb, ox + 220, oy + 185, "v", COL_HIGHLIGHT, 2);
-    }
+    int had_dupes = rm->has_dupes;
+    rm->has_dupes = 0;
+    for (int i = 0; i < NUM_MAPPINGS; i++) {
+        MappingEntry *m = &app->mappings[i];
 
-    /* Left triangle button */
-    {
-        uint32_t tc = elem_color(app, 2, COL_BTN);
-        int cx = ox + 290, cy = oy + 205;
-        draw_triangle_filled(fb, cx, cy - 16, cx - 14, cy + 10, cx + 14, cy + 10, tc);
-        draw_text_centered(fb, cx, cy + 16, "L.Tri", COL_TEXT, 1);
-    }
-    /* Right triangle button */
-    {
-        uint32_t tc = elem_color(app, 3, COL_BTN);
-        int cx = ox + 365, cy = oy + 205;
-        draw_triangle_filled(fb, cx, cy - 16, cx - 14, cy + 10, cx + 14, cy + 10, tc);
-        draw_text_centered(fb, cx, cy + 16, "R.Tri", COL_TEXT, 1);
-    }
+        switch (m->mapped_type) {
+        case MAP_BUTTON:
+            snprintf(rm->mapped_to[i], sizeof(rm->mapped_to[i]),
+                     "Button %d", m->mapped_index);
+            break;
+        case MAP_AXIS:
+            snprintf(rm->mapped_to[i], sizeof(rm->mapped_to[i]),
+                     "Axis %d", m->mapped_index);
+            break;
+        case MAP_HAT:
+            snprintf(rm->mapped_to[i], sizeof(rm->mapped_to[i]),
+                     "Hat %d.%d", m->mapped_index, m->hat_mask);
+            break;
+        default:
+            snprintf(rm->mapped_to[i], sizeof(rm->mapped_to[i]), "(none)");
+            break;
+        }
 
-    /* Menu buttons 1-4 */
-    {
-        int mw = 50, mh = 22, gap = 10;
-        int total = 4 * mw + 3 * gap;
-        int sx = ox + (JOY_W - total) / 2;
-        int sy = oy + 248;
-        const char *labels[] = {"M1", "M2", "M3", "M4"};
-        for (int i = 0; i < 4; i++) {
-            int mx = sx + i * (mw + gap);
-            uint32_t mc = elem_color(app, 4 + i, COL_BTN);
-            draw_rounded_rect(fb, mx, sy, mw, mh, 6, mc);
-            draw_text_centered(fb, mx + mw / 2, sy + 3, labels[i], COL_TEXT, 1);
+        format_mapping_value(m, val, sizeof(val));
+        snprintf(rm->gcdb_value[i], sizeof(rm->gcdb_value[i]), "%s:%s",
+                 m->gcdb_name, val);
+
+        rm->dups[i][0] = '\0';
+        if (m->mapped_type == MAP_NONE) continue;
+        int pos = 0;
+        for (int j = 0; j < NUM_MAPPINGS; j++) {
+            if (j == i || !mappings_equal(&app->mappings[j], m)) continue;
+            if (pos < (int)sizeof(rm->dups[i]))
+                pos += snprintf(rm->dups[i] + pos, sizeof(rm->dups[i]) - pos,
+                                "%s%s", pos ? ", " : "",
+                                app->mappings[j].the64_label);
+            rm->has_dupes = 1;
         }
     }
+    /* count each time a warning appears, not every rebuild during it */
+    if (rm->has_dupes && !had_dupes)
+        app->tlm.cur.dup_warnings++;
 
-    /* Label stick */
-    draw_text_centered(fb, ox + 220, oy + 190, "Stick", COL_TEXT_DIM, 1);
+    build_mapping_string(app, app->mapping_str, sizeof(app->mapping_str));
+    rm->built_version = rm->version;
 }
 
 /* ================================================================
- * Directory browser
+ * Session telemetry
  * ================================================================ */
 
-static int dir_entry_cmp(const void *a, const void *b)
+/* One record per session, little-endian (read by gamepad_tlm.c):
+ *   u16 magic "TL"  u16 record length  u32 start (unix time)
+ *   char guid[32]   char name[TLM_NAME_LEN]
+ *   u32 prompt_ms[10]  (time on each prompt, summed over redos)
+ *   u16 redos  u16 restarts  u16 dup_warnings  u8 outcome  u8 save_failures
+ *   u32 save_ms (session start to first successful save, 0 = not saved)
+ *   u32 total_ms */
+
+static void tlm_open(Telemetry *t, const char *path)
 {
-    const DirEntry *da = a, *db = b;
-    /* dirs before files */
-    if (da->is_dir != db->is_dir)
-        return db->is_dir - da->is_dir;
-    return strcasecmp(da->name, db->name);
+    t->fd = -1;
+    if (!path) return;
+    t->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (t->fd < 0)
+        perror(path);
 }
 
-static void browser_load(DirBrowser *b, const char *path)
+static void tlm_session_begin(Telemetry *t, const Controller *c)
 {
-    DIR *dir;
-    struct dirent *entry;
-    struct stat st;
-    char fullpath[MAX_PATH_LEN];
-
-    strncpy(b->path, path, MAX_PATH_LEN - 1);
-    b->count = 0;
-    b->selected = 0;
-    b->scroll = 0;
+    if (t->fd < 0) return;
+    memset(&t->cur, 0, sizeof(t->cur));
+    t->cur.active = 1;
+    t->cur.start_ms = time_ms();
+    t->cur.start_time = (uint32_t)time(NULL);
+    memcpy(t->cur.guid, c->guid, sizeof(t->cur.guid));
+    snprintf(t->cur.name, sizeof(t->cur.name), "%.*s", TLM_NAME_LEN - 1,
+             c->name);
+}
 
-    /* add ".." unless root */
-    if (strcmp(b->path, "/") != 0) {
-        strcpy(b->entries[0].name, "..");
-        b->entries[0].is_dir = 1;
-        b->count = 1;
-    }
-
-    dir = opendir(path);
-    if (!dir) return;
+static void tlm_prompt_begin(Telemetry *t)
+{
+    t->cur.prompt_start = time_ms();
+}
 
-    while ((entry = readdir(dir)) != NULL && b->count < MAX_DIR_ENTRIES) {
-        if (entry->d_name[0] == '.') continue;
+static void tlm_prompt_done(Telemetry *t, int idx)
+{
+    if (t->cur.prompt_start && idx >= 0 && idx < NUM_MAPPINGS)
+        t->cur.prompt_ms[idx] += (uint32_t)(time_ms() - t->cur.prompt_start);
+    t->cur.prompt_start = 0;
+}
 
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", path, entry->d_name);
-        if (stat(fullpath, &st) < 0) continue;
-        if (!S_ISDIR(st.st_mode)) continue;
+static void tlm_save_result(Telemetry *t, int err)
+{
+    if (!t->cur.active) return;
+    if (err)
+        t->cur.save_failures++;
+    else if (!t->cur.save_ms)
+        t->cur.save_ms = (uint32_t)(time_ms() - t->cur.start_ms);
+}
 
-        snprintf(b->entries[b->count].name, sizeof(b->entries[b->count].name),
-                 "%s", entry->d_name);
-        b->entries[b->count].is_dir = 1;
-        b->count++;
+/* Write out buffered records; whatever cannot be written stays queued */
+static void tlm_flush(Telemetry *t)
+{
+    if (t->fd < 0 || t->len == 0) return;
+    if (write_all(t->fd, (const char *)t->buf, t->len) < 0) {
+        perror("telemetry");
+        return;
     }
-    closedir(dir);
+    t->len = 0;
+}
 
-    /* sort (skip ".." at index 0 if present) */
-    int start = (b->count > 0 && strcmp(b->entries[0].name, "..") == 0) ? 1 : 0;
-    if (b->count - start > 1)
-        qsort(&b->entries[start], b->count - start, sizeof(DirEntry),
-              dir_entry_cmp);
+static uint16_t sat16(unsigned v) { return v > 0xFFFF ? 0xFFFF : v; }
 
-    /* add export action at the end */
-    if (b->count < MAX_DIR_ENTRIES) {
-        snprintf(b->entries[b->count].name, sizeof(b->entries[b->count].name),
-                 ">> Export here <<");
-        b->entries[b->count].is_dir = 0;
-        b->count++;
+/* Encode the session into the preallocated buffer and flush it */
+static void tlm_session_end(Telemetry *t, int outcome)
+{
+    TlmSession *s = &t->cur;
+    if (!s->active) return;
+    s->active = 0;
+
+    if (t->len + TLM_RECORD_LEN > sizeof(t->buf)) {
+        t->dropped++;
+        fprintf(stderr, "telemetry buffer full, %u session(s) dropped\n",
+                t->dropped);
+        return;
     }
+    uint8_t *p = t->buf + t->len;
+    p = put16(p, TLM_MAGIC);
+    p = put16(p, TLM_RECORD_LEN);
+    p = put32(p, s->start_time);
+    memcpy(p, s->guid, 32);                       p += 32;
+    memcpy(p, s->name, TLM_NAME_LEN);             p += TLM_NAME_LEN;
+    for (int i = 0; i < NUM_MAPPINGS; i++)
+        p = put32(p, s->prompt_ms[i]);
+    p = put16(p, sat16(s->redos));
+    p = put16(p, sat16(s->restarts));
+    p = put16(p, sat16(s->dup_warnings));
+    *p++ = outcome;
+    *p++ = s->save_failures > 0xFF ? 0xFF : s->save_failures;
+    p = put32(p, s->save_ms);
+    p = put32(p, (uint32_t)(time_ms() - s->start_ms));
+    t->len += TLM_RECORD_LEN;
+
+    tlm_flush(t);
+}
+
+/* End any open session and close the log */
+static void tlm_close(Telemetry *t, int outcome)
+{
+    tlm_session_end(t, outcome);
+    tlm_flush(t);
+    if (t->fd >= 0)
+        close(t->fd);
+    t->fd = -1;
 }
 
 /* ================================================================
- * Navigation input (using mapped controls)
+ * Saving
  * ================================================================ */
 
-static int read_nav_input(App *app, int *dy, int *dx, int *btn_a, int *btn_b,
-                           int *btn_start)
+/* Path of the <GUID>.txt file inside dir */
+static void build_save_path(const char *dir, const char *guid,
+                            char *out, size_t sz)
 {
-    Controller *c = &app->controllers[app->sel_ctrl];
-    struct input_event ev;
+    if (strcmp(dir, "/") == 0)
+        snprintf(out, sz, "/%.32s.txt", guid);
+    else
+        snprintf(out, sz, "%.470s/%.32s.txt", dir, guid);
+}
 
-    *dy = 0; *dx = 0; *btn_a = 0; *btn_b = 0; *btn_start = 0;
+/* Write the mapping durably: write to <file>.tmp, fsync, rename over the
+ * target and fsync the directory. Returns -1 with errno set on failure. */
+static int save_mapping_file(const char *filepath, const char *mapping)
+{
+    char tmp[MAX_PATH_LEN + 8];
+    char dirpath[MAX_PATH_LEN];
+    int fd, err;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filepath);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    if (write_all(fd, mapping, strlen(mapping)) < 0 ||
+        write_all(fd, "\n", 1) < 0 || fsync(fd) < 0) {
+        err = errno;
+        close(fd);
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    if (close(fd) < 0 || rename(tmp, filepath) < 0) {
+        err = errno;
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
 
-    while (read(c->fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
-        if (ev.type == EV_KEY && ev.value == 1) {
-            int idx = c->btn_map[ev.code];
-            if (idx < 0) continue;
-            /* compare with mapped buttons */
-            if (app->mappings[0].mapped_type == MAP_BUTTON &&
-                idx == app->mappings[0].mapped_index) *btn_a = 1; /* Left Fire = confirm */
-            if (app->mappings[4].mapped_type == MAP_BUTTON &&
-                idx == app->mappings[4].mapped_index) *btn_a = 1;
-            if (app->mappings[5].mapped_type == MAP_BUTTON &&
-                idx == app->mappings[5].mapped_index) *btn_b = 1;
-            if (app->mappings[7].mapped_type == MAP_BUTTON &&
-                idx == app->mappings[7].mapped_index) *btn_start = 1;
-        }
-        else if (ev.type == EV_ABS) {
-            /* lefty (index 9) for vertical nav */
-            MappingEntry *my = &app->mappings[9];
-            if (my->mapped_type == MAP_AXIS && c->abs_map[ev.code] == my->mapped_index) {
-                int range = c->axis_max[ev.code] - c->axis_min[ev.code];
-                int thresh = range > 0 ? range * 2 / 5 : 1;
-                int delta = ev.value - c->axis_initial[ev.code];
-                if (delta < -thresh) *dy = -1;
-                else if (delta > thresh) *dy = 1;
-                else *dy = 0;
-            }
-            if (my->mapped_type == MAP_HAT && c->hat_map[ev.code] == my->mapped_index) {
-                if (ev.value < 0) *dy = -1;
-                else if (ev.value > 0) *dy = 1;
-                else *dy = 0;
-            }
-            /* leftx (index 8) for horizontal nav */
-            MappingEntry *mx = &app->mappings[8];
-            if (mx->mapped_type == MAP_AXIS && c->abs_map[ev.code] == mx->mapped_index) {
-                int range = c->axis_max[ev.code] - c->axis_min[ev.code];
-                int thresh = range > 0 ? range * 2 / 5 : 1;
-                int delta = ev.value - c->axis_initial[ev.code];
-                if (delta < -thresh) *dx = -1;
-                else if (delta > thresh) *dx = 1;
-                else *dx = 0;
-            }
-            if (mx->mapped_type == MAP_HAT && c->hat_map[ev.code] == mx->mapped_index) {
-                if (ev.value < 0) *dx = -1;
-                else if (ev.value > 0) *dx = 1;
-                else *dx = 0;
-            }
+    /* make the rename itself durable; not all filesystems allow this */
+    snprintf(dirpath, sizeof(dirpath), "%s", filepath);
+    char *slash = strrchr(dirpath, '/');
+    if (slash) {
+        if (slash == dirpath) slash[1] = '\0'; else *slash = '\0';
+        fd = open(dirpath, O_RDONLY | O_DIRECTORY);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
         }
     }
-
-    /* Also read THEJOYSTICK if available (merges into same outputs) */
-    read_thec64_nav(app, dy, dx, btn_a, btn_b, btn_start);
-
-    return (*dy || *dx || *btn_a || *btn_b || *btn_start);
+    return 0;
 }
 
-/* ================================================================
- * Mapping input detection
- * ================================================================ */
-
-static int poll_mapping_input(App *app, MappingEntry *entry)
+static void *save_worker(void *arg)
 {
-    Controller *c = &app->controllers[app->sel_ctrl];
-    struct input_event ev;
-
-    while (read(c->fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
-        if (ev.type == EV_KEY && ev.value == 1) {
-            int idx = c->btn_map[ev.code];
-            if (idx >= 0) {
-                entry->mapped_type = MAP_BUTTON;
-                entry->mapped_index = idx;
-                return 1;
-            }
-        }
-        else if (ev.type == EV_ABS) {
-            if (ev.code >= ABS_HAT0X && ev.code <= ABS_HAT3Y && ev.value != 0) {
-                int hat = (ev.code - ABS_HAT0X) / 2;
-                int mask;
-                if ((ev.code - ABS_HAT0X) % 2 == 0)
-                    mask = (ev.value < 0) ? 8 : 2;   /* L=8, R=2 */
-                else
-                    mask = (ev.value < 0) ? 1 : 4;   /* U=1, D=4 */
-                entry->mapped_type = MAP_HAT;
-                entry->mapped_index = hat;
-                entry->hat_mask = mask;
-                return 1;
-            }
-            else {
-                int aidx = c->abs_map[ev.code];
-                if (aidx >= 0) {
-                    /* Use 40% of half-range as threshold, works for all axis sizes */
-                    int range = c->axis_max[ev.code] - c->axis_min[ev.code];
-                    int thresh = range > 0 ? range * 2 / 5 : 1;
-                    int delta = ev.value - c->axis_initial[ev.code];
-                    if (delta > thresh || delta < -thresh) {
-                        entry->mapped_type = MAP_AXIS;
-                        entry->mapped_index = aidx;
-                        return 1;
-                    }
-                }
-            }
-        }
+    SaveQueue *q = arg;
+    SaveJob job;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (q->job_count == 0 && !q->stop)
+            pthread_cond_wait(&q->cond, &q->lock);
+        if (q->job_count == 0)
+            break;  /* stopping and nothing left to write */
+
+        job = q->jobs[q->job_head];
+        pthread_mutex_unlock(&q->lock);
+
+        job.err = save_mapping_file(job.path, job.data) == 0 ? 0 : errno;
+
+        pthread_mutex_lock(&q->lock);
+        q->job_head = (q->job_head + 1) % SAVE_QUEUE_LEN;
+        q->job_count--;
+        /* done ring is as long as the job ring, so it cannot overflow */
+        q->done[(q->done_head + q->done_count) % SAVE_QUEUE_LEN] = job;
+        q->done_count++;
     }
-    return 0;
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
 }
 
-/* ================================================================
- * State: detect controller
- * ================================================================ */
+static void save_queue_start(SaveQueue *q)
+{
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    q->running = start_worker(&q->thread, save_worker, q) == 0;
+    if (!q->running)
+        fprintf(stderr, "save worker unavailable, saving synchronously\n");
+}
 
-static void update_detect(App *app)
+/* Finish any queued writes, then stop the worker */
+static void save_queue_stop(SaveQueue *q)
 {
-    uint64_t now = time_ms();
+    if (!q->running) return;
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread, NULL);
+    q->running = 0;
+}
 
-    /* Periodic rescan */
-    if (now - app->last_scan > RESCAN_MS) {
-        scan_controllers(app);
-        app->last_scan = now;
+/* Queue a save job. Returns -1 if the worker is unavailable or busy. */
+static int save_queue_submit(SaveQueue *q, const char *path, const char *data)
+{
+    int rc = -1;
+    if (!q->running) return -1;
+    pthread_mutex_lock(&q->lock);
+    if (q->job_count + q->done_count < SAVE_QUEUE_LEN) {
+        SaveJob *job = &q->jobs[(q->job_head + q->job_count) % SAVE_QUEUE_LEN];
+        snprintf(job->path, sizeof(job->path), "%s", path);
+        snprintf(job->data, sizeof(job->data), "%s", data);
+        job->err = 0;
+        q->job_count++;
+        pthread_cond_signal(&q->cond);
+        rc = 0;
     }
+    pthread_mutex_unlock(&q->lock);
+    return rc;
+}
 
-    /* Check for button press on any controller */
-    for (int i = 0; i < app->num_controllers; i++) {
-        struct input_event ev;
-        while (read(app->controllers[i].fd, &ev, sizeof(ev)) ==
-               (ssize_t)sizeof(ev)) {
-            if (ev.type == EV_KEY && ev.value == 1) {
-                app->sel_ctrl = i;
-                find_thec64_nav(app);
-                /* drain all controllers */
-                for (int j = 0; j < app->num_controllers; j++)
-                    drain_events(app->controllers[j].fd);
-                app->state = STATE_MAPPING;
-                app->cur_map = 0;
-                app->redo_single = -1;
-                return;
-            }
-        }
+/* Take one finished job, if any. Never blocks on the writer. */
+static int save_queue_poll(SaveQueue *q, SaveJob *out)
+{
+    int got = 0;
+    if (!q->running) return 0;
+    if (pthread_mutex_trylock(&q->lock) != 0) return 0;
+    if (q->done_count > 0) {
+        *out = q->done[q->done_head];
+        q->done_head = (q->done_head + 1) % SAVE_QUEUE_LEN;
+        q->done_count--;
+        got = 1;
     }
+    pthread_mutex_unlock(&q->lock);
+    return got;
 }
 
-static void render_detect(App *app)
+static void save_finished(App *app, const char *path, int err)
 {
-    Framebuffer *fb = &app->fb;
-    int cx = fb->width / 2;
-
-    draw_text_centered(fb, cx, 60, "THEC64 GAMEPAD MAPPER", COL_TEXT_TITLE, 3);
-
-    draw_text_centered(fb, cx, 180, "Press any button on the controller",
-                        COL_TEXT, 2);
-    draw_text_centered(fb, cx, 220, "you want to map", COL_TEXT, 2);
+    snprintf(app->save_path, sizeof(app->save_path), "%s", path);
+    app->save_err = err;
+    tlm_save_result(&app->tlm, err);
+    if (err)
+        fprintf(stderr, "save %s: %s\n", path, strerror(err));
+}
 
-    int y = 320;
-    if (app->num_controllers == 0) {
-        draw_text_centered(fb, cx, y,
-                            "No controllers detected. Connect a USB controller.",
-                            COL_TEXT_DIM, 1);
-    } else {
-        draw_text_centered(fb, cx, y - 30, "Detected controllers:", COL_TEXT, 1);
-        for (int i = 0; i < app->num_controllers; i++) {
-            char buf[512];
-            snprintf(buf, sizeof(buf), "%d. %s  [%s]",
-                     i + 1, app->controllers[i].name, app->controllers[i].path);
-            draw_text(fb, 100, y + i * 24, buf, COL_TEXT, 1);
-        }
+/* Hand finished background saves back to the state machine, and
+ * resubmit a save that found the queue full */
+static void poll_save_results(App *app)
+{
+    SaveJob job;
+    SaveJob *r = &app->save_retry;
+
+    if (r->path[0] && save_queue_submit(&app->saveq, r->path, r->data) == 0)
+        r->path[0] = '\0';  /* already counted in save_pending */
+    while (app->save_pending > 0 && save_queue_poll(&app->saveq, &job)) {
+        app->save_pending--;
+        save_finished(app, job.path, job.err);
     }
 }
 
 /* ================================================================
- * State: mapping
+ * Screen recording
  * ================================================================ */
 
-static void update_mapping(App *app)
+/* File layout, little-endian (read by gamepad_rec2png.c):
+ *   header: "GMRC" u16 version u16 tile u16 width u16 height u32 0
+ *   frame:  u32 ms u16 ntiles u16 0, then ntiles x
+ *           u16 tile_x u16 tile_y u32 len, len bytes of RLE data
+ * Tile data is the tile's pixels row by row (clipped at the right and
+ * bottom edges) as RGB triples in PackBits-style runs: a control byte
+ * c < 128 is followed by c+1 literal pixels, c >= 128 by one pixel
+ * repeated c-126 times. */
+#define REC_VERSION 1
+#define REC_TILE_MAX_BYTES (8 + 2 * (REC_TILE * REC_TILE / 128) + \
+                            3 * REC_TILE * REC_TILE)
+
+static uint8_t *put_rgb(uint8_t *p, uint32_t c)
 {
-    MappingEntry *m = &app->mappings[app->cur_map];
-    if (poll_mapping_input(app, m)) {
-        drain_events(app->controllers[app->sel_ctrl].fd);
-        usleep(DEBOUNCE_MS * 1000);
-        drain_events(app->controllers[app->sel_ctrl].fd);
-
-        if (app->redo_single >= 0) {
-            /* was redoing a single mapping, go back to review */
-            app->redo_single = -1;
-            app->state = STATE_REVIEW;
-            return;
-        }
+    p[0] = c >> 16; p[1] = c >> 8; p[2] = c;
+    return p + 3;
+}
 
-        app->cur_map++;
-        if (app->cur_map >= NUM_MAPPINGS) {
-            app->state = STATE_REVIEW;
-            app->review_sel = 0;
-            /* generate mapping string */
-            build_mapping_string(app, app->mapping_str, sizeof(app->mapping_str));
+static uint8_t *rec_rle(uint8_t *p, const uint32_t *px, int n)
+{
+    int i = 0;
+    while (i < n) {
+        int run = 1;
+        while (i + run < n && run < 129 &&
+               ((px[i + run] ^ px[i]) & 0xFFFFFF) == 0)
+            run++;
+        if (run >= 2) {
+            *p++ = 126 + run;
+            p = put_rgb(p, px[i]);
+            i += run;
+            continue;
         }
+        /* literals up to the next run of two */
+        int lit = 1;
+        while (i + lit < n && lit < 128 &&
+               (i + lit + 1 >= n ||
+                ((px[i + lit + 1] ^ px[i + lit]) & 0xFFFFFF) != 0))
+            lit++;
+        *p++ = lit - 1;
+        for (int k = 0; k < lit; k++)
+            p = put_rgb(p, px[i + k]);
+        i += lit;
     }
+    return p;
 }
 
-static void render_mapping(App *app)
+/* Tile size after clipping at the frame edge */
+static void rec_tile_dims(const Recorder *r, int tx, int ty, int *w, int *h)
 {
-    Framebuffer *fb = &app->fb;
-    int cx = fb->width / 2;
-    MappingEntry *m = &app->mappings[app->cur_map];
-    char buf[256];
-
-    /* Header bar */
-    draw_rect(fb, 0, 0, fb->width, 36, COL_HEADER_BG);
-    snprintf(buf, sizeof(buf), "Mapping: %s (%d/%d)",
-             app->controllers[app->sel_ctrl].name,
-             app->cur_map + 1, NUM_MAPPINGS);
-    draw_text(fb, 16, 10, buf, COL_TEXT, 1);
+    *w = r->width - tx * REC_TILE;
+    *h = r->height - ty * REC_TILE;
+    if (*w > REC_TILE) *w = REC_TILE;
+    if (*h > REC_TILE) *h = REC_TILE;
+}
 
-    snprintf(buf, sizeof(buf), "GUID: %s", app->controllers[app->sel_ctrl].guid);
-    draw_text(fb, fb->width - text_width(buf, 1) - 16, 10, buf, COL_TEXT_DIM, 1);
+static void rec_write_frame(Recorder *r, const RecFrame *f)
+{
+    uint8_t *p = r->out;
+
+    p = put32(p, f->ms);
+    p = put16(p, f->ntiles);
+    p = put16(p, 0);
+    for (int i = 0; i < f->ntiles; i++) {
+        int tx = f->pos[2 * i], ty = f->pos[2 * i + 1], w, h;
+        rec_tile_dims(r, tx, ty, &w, &h);
+        p = put16(p, tx);
+        p = put16(p, ty);
+        uint8_t *len = p;
+        p = rec_rle(p + 4, f->px + (size_t)i * REC_TILE * REC_TILE, w * h);
+        put32(len, p - len - 4);
+    }
+    if (!r->err && write_all(r->fd, (const char *)r->out, p - r->out) < 0)
+        r->err = errno;
+    r->bytes += p - r->out;
+}
 
-    /* Joystick graphic */
-    int jx = cx - JOY_W / 2;
-    int jy = 50;
-    draw_joystick(fb, app, jx, jy);
+static void *rec_worker(void *arg)
+{
+    Recorder *r = arg;
 
-    /* Prompt */
-    int py = jy + JOY_H + 20;
-    snprintf(buf, sizeof(buf), ">>> %s <<<", m->prompt);
-    draw_text_centered(fb, cx, py, buf, app->blink ? COL_HIGHLIGHT : COL_TEXT, 2);
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (r->count == 0 && !r->stop)
+            pthread_cond_wait(&r->cond, &r->lock);
+        if (r->count == 0)
+            break;
+        RecFrame *f = &r->slots[r->head];
+        pthread_mutex_unlock(&r->lock);
 
-    /* Sub-label */
-    snprintf(buf, sizeof(buf), "for: %s (%s)", m->the64_label, m->gcdb_name);
-    draw_text_centered(fb, cx, py + 40, buf, COL_TEXT_DIM, 1);
+        rec_write_frame(r, f);
 
-    /* Already mapped summary */
-    int sy = py + 70;
-    draw_text(fb, 100, sy, "Mapped so far:", COL_TEXT_DIM, 1);
-    sy += 20;
-    for (int i = 0; i < app->cur_map; i++) {
-        MappingEntry *mi = &app->mappings[i];
-        switch (mi->mapped_type) {
-        case MAP_BUTTON:
-            snprintf(buf, sizeof(buf), "  %s = b%d", mi->gcdb_name,
-                     mi->mapped_index);
-            break;
-        case MAP_AXIS:
-            snprintf(buf, sizeof(buf), "  %s = a%d", mi->gcdb_name,
-                     mi->mapped_index);
-            break;
-        case MAP_HAT:
-            snprintf(buf, sizeof(buf), "  %s = h%d.%d", mi->gcdb_name,
-                     mi->mapped_index, mi->hat_mask);
-            break;
-        default:
-            snprintf(buf, sizeof(buf), "  %s = (none)", mi->gcdb_name);
-            break;
-        }
-        draw_text(fb, 100, sy + i * 18, buf, COL_MAPPED, 1);
+        pthread_mutex_lock(&r->lock);
+        r->head = (r->head + 1) % REC_SLOTS;
+        r->count--;
     }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
 }
 
-/* ================================================================
- * State: review
- * ================================================================ */
-
-/* Helper: redo the currently selected mapping row */
-static void review_redo_selected(App *app)
+/* Open the recording and start the writer. Returns -1 on failure. */
+static int rec_start(Recorder *r, const char *path, const Framebuffer *fb)
 {
-    if (app->review_sel >= 0 && app->review_sel < NUM_MAPPINGS) {
-        app->redo_single = app->review_sel;
-        app->cur_map = app->review_sel;
-        app->mappings[app->cur_map].mapped_type = MAP_NONE;
-        app->state = STATE_MAPPING;
-        drain_nav_events(app);
+    uint8_t hdr[16], *p = hdr;
+    size_t tiles, tile_px = REC_TILE * REC_TILE;
+
+    memset(r, 0, sizeof(*r));
+    r->width = fb->width;
+    r->height = fb->height;
+    r->tiles_x = (fb->width + REC_TILE - 1) / REC_TILE;
+    r->tiles_y = (fb->height + REC_TILE - 1) / REC_TILE;
+    tiles = (size_t)r->tiles_x * r->tiles_y;
+
+    r->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (r->fd < 0) { perror(path); return -1; }
+
+    /* prev starts out unlike any frame, so the first is recorded whole */
+    r->prev = malloc((size_t)r->width * r->height * sizeof(uint32_t));
+    r->out = malloc(8 + tiles * REC_TILE_MAX_BYTES);
+    int ok = r->prev && r->out;
+    for (int i = 0; i < REC_SLOTS && ok; i++) {
+        r->slots[i].pos = malloc(tiles * 2 * sizeof(uint16_t));
+        r->slots[i].px = malloc(tiles * tile_px * sizeof(uint32_t));
+        ok = r->slots[i].pos && r->slots[i].px;
+    }
+    if (ok) {
+        memset(r->prev, 0x5A, (size_t)r->width * r->height * sizeof(uint32_t));
+        memcpy(p, "GMRC", 4); p += 4;
+        p = put16(p, REC_VERSION);
+        p = put16(p, REC_TILE);
+        p = put16(p, r->width);
+        p = put16(p, r->height);
+        p = put32(p, 0);
+        ok = write_all(r->fd, (const char *)hdr, sizeof(hdr)) == 0;
+        if (!ok) perror(path);
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    if (ok && start_worker(&r->thread, rec_worker, r) == 0) {
+        r->running = 1;
+        r->start_ms = time_ms();
+        return 0;
     }
-}
 
-/* Helper: start mapping all over */
-static void review_restart(App *app)
-{
-    init_mappings(app->mappings);
-    app->cur_map = 0;
-    app->redo_single = -1;
-    app->state = STATE_MAPPING;
-    drain_nav_events(app);
+    fprintf(stderr, "recording to %s unavailable\n", path);
+    close(r->fd);
+    free(r->prev);
+    free(r->out);
+    for (int i = 0; i < REC_SLOTS; i++) {
+        free(r->slots[i].pos);
+        free(r->slots[i].px);
+    }
+    memset(r, 0, sizeof(*r));
+    return -1;
 }
 
-/* Helper: go to directory browser to save */
-static void review_save(App *app)
+/* Queue the tiles of the backbuffer that changed since the last recorded
+ * frame. Never waits for the writer. */
+static void rec_frame(Recorder *r, const Framebuffer *fb)
 {
-    browser_load(&app->browser, "/mnt");
-    app->state = STATE_BROWSE;
-    drain_nav_events(app);
+    if (!r->running) return;
+    if (pthread_mutex_trylock(&r->lock) != 0) { r->dropped++; return; }
+    int full = r->count == REC_SLOTS;
+    RecFrame *f = &r->slots[(r->head + r->count) % REC_SLOTS];
+    pthread_mutex_unlock(&r->lock);
+    if (full) { r->dropped++; return; }
+
+    /* the slot is ours until it is counted in */
+    f->ntiles = 0;
+    f->ms = (uint32_t)(time_ms() - r->start_ms);
+    for (int ty = 0; ty < r->tiles_y; ty++) {
+        for (int tx = 0; tx < r->tiles_x; tx++) {
+            int w, h, y;
+            rec_tile_dims(r, tx, ty, &w, &h);
+            const uint32_t *src = fb->backbuf +
+                (size_t)ty * REC_TILE * fb->stride_px + tx * REC_TILE;
+            uint32_t *old = r->prev +
+                (size_t)ty * REC_TILE * r->width + tx * REC_TILE;
+
+            for (y = 0; y < h; y++)
+                if (memcmp(src + (size_t)y * fb->stride_px,
+                           old + (size_t)y * r->width, w * 4) != 0)
+                    break;
+            if (y == h) continue;
+
+            uint32_t *dst = f->px + (size_t)f->ntiles * REC_TILE * REC_TILE;
+            for (y = 0; y < h; y++) {
+                memcpy(dst + y * w, src + (size_t)y * fb->stride_px, w * 4);
+                memcpy(old + (size_t)y * r->width,
+                       src + (size_t)y * fb->stride_px, w * 4);
+            }
+            f->pos[2 * f->ntiles] = tx;
+            f->pos[2 * f->ntiles + 1] = ty;
+            f->ntiles++;
+        }
+    }
+    if (f->ntiles == 0) return;  /* nothing changed, nothing to write */
+
+    pthread_mutex_lock(&r->lock);
+    r->count++;
+    r->frames++;
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&r->lock);
 }
 
-static void update_review(App *app)
+/* Write out the queued frames and close the recording */
+static void rec_stop(Recorder *r)
 {
-    int dy, dx, btn_a, btn_b, btn_start;
-    int got_ctrl = read_nav_input(app, &dy, &dx, &btn_a, &btn_b, &btn_start);
-
-    /* Keyboard input */
-    int key = read_keyboard(app);
-    if (key == KEY_UP)    dy = -1;
-    if (key == KEY_DOWN)  dy = 1;
-    if (key == KEY_RIGHT) dx = 1;
-    if (key == KEY_1)     { review_redo_selected(app); return; }
-    if (key == KEY_2)     { review_save(app); return; }
-    if (key == KEY_3)     { review_restart(app); return; }
-    if (key == KEY_4) {
-        init_mappings(app->mappings);
-        app->sel_ctrl = -1;
-        app->thec64_nav_idx = -1;
-        app->state = STATE_DETECT;
-        app->save_path[0] = '\0';
-        return;
+    if (!r->running) return;
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+    r->running = 0;
+
+    if (r->err)
+        fprintf(stderr, "recording: %s\n", strerror(r->err));
+    if (close(r->fd) < 0 && !r->err)
+        perror("recording");
+    fprintf(stderr, "Recorded %u frames (%u dropped), %llu KB\n",
+            r->frames, r->dropped, (unsigned long long)(r->bytes + 16) / 1024);
+    free(r->prev);
+    free(r->out);
+    for (int i = 0; i < REC_SLOTS; i++) {
+        free(r->slots[i].pos);
+        free(r->slots[i].px);
     }
-    if (key == KEY_Q || key == KEY_ESC) { app->state = STATE_EXIT; return; }
+}
 
-    if (!got_ctrl && !key)
-        return;
+/* ================================================================
+ * Draw THEJOYSTICK graphic
+ * ================================================================ */
+
+/* joystick element bounding boxes (relative to origin) */
+#define JOY_W  600
+#define JOY_H  300
+
+/* Element colour based on mapping state */
+static uint32_t elem_color(App *app, int idx, uint32_t normal)
+{
+    if (app->state == STATE_MAPPING && app->cur_map == idx && app->blink)
+        return COL_HIGHLIGHT;
+    if (app->state == STATE_TEST && app->test.active[idx])
+        return COL_HIGHLIGHT;
+    if (app->mappings[idx].mapped_type != MAP_NONE)
+        return COL_MAPPED;
+    return normal;
+}
+
+/* Colour for the stick (shared by leftx=8 and lefty=9) */
+static uint32_t stick_color(App *app)
+{
+    if (app->state == STATE_MAPPING &&
+        (app->cur_map == 8 || app->cur_map == 9) && app->blink)
+        return COL_HIGHLIGHT;
+    if (app->state == STATE_TEST && (app->test.active[8] || app->test.active[9]))
+        return COL_HIGHLIGHT;
+    if (app->mappings[8].mapped_type != MAP_NONE &&
+        app->mappings[9].mapped_type != MAP_NONE)
+        return COL_MAPPED;
+    if (app->mappings[8].mapped_type != MAP_NONE ||
+        app->mappings[9].mapped_type != MAP_NONE)
+        return 0xFF66AA44;  /* partial = yellow-green */
+    return COL_STICK_TOP;
+}
+
+/* Bounding boxes relative to the graphic origin: x, y, w, h. The stick
+ * box leaves room for the ball to move STICK_TRAVEL px each way. */
+#define STICK_TRAVEL 20
+static const int joy_elem_box[NUM_JOY_ELEMS][4] = {
+    {  38, 100, 108, 40 }, { 454, 100, 108, 40 },
+    { 270, 189,  40, 48 }, { 345, 189,  40, 48 },
+    { 185, 248,  50, 22 }, { 245, 248,  50, 22 },
+    { 305, 248,  50, 22 }, { 365, 248,  50, 22 },
+    { 168,  10, 104, 178 },
+};
+
+static void draw_joystick_body(Framebuffer *fb, int ox, int oy)
+{
+    /* Body shadow */
+    draw_rounded_rect(fb, ox + 33, oy + 53, 540, 180, 20, COL_BODY_DARK);
+    /* Body */
+    draw_rounded_rect(fb, ox + 30, oy + 50, 540, 180, 20, COL_BODY);
+    /* Label stick */
+    draw_text_centered(fb, ox + 220, oy + 190, "Stick", COL_TEXT_DIM, 1);
+}
+
+/* Draw one element; (sdx, sdy) displaces the stick ball */
+static void draw_joystick_elem(Framebuffer *fb, int ox, int oy, int e,
+                               uint32_t col, int sdx, int sdy)
+{
+    static const char *menu_labels[] = {"M1", "M2", "M3", "M4"};
+
+    switch (e) {
+    case JE_LFIRE:
+        draw_rounded_rect(fb, ox + 38, oy + 100, 108, 40, 10, col);
+        draw_text_centered(fb, ox + 92, oy + 108, "L.Fire", COL_TEXT, 1);
+        break;
+    case JE_RFIRE:
+        draw_rounded_rect(fb, ox + 454, oy + 100, 108, 40, 10, col);
+        draw_text_centered(fb, ox + 508, oy + 108, "R.Fire", COL_TEXT, 1);
+        break;
+    case JE_LTRI:
+    case JE_RTRI: {
+        int cx = ox + (e == JE_LTRI ? 290 : 365), cy = oy + 205;
+        draw_triangle_filled(fb, cx, cy - 16, cx - 14, cy + 10, cx + 14, cy + 10, col);
+        draw_text_centered(fb, cx, cy + 16, e == JE_LTRI ? "L.Tri" : "R.Tri",
+                           COL_TEXT, 1);
+        break;
+    }
+    case JE_M1: case JE_M2: case JE_M3: case JE_M4: {
+        const int *bx = joy_elem_box[e];
+        draw_rounded_rect(fb, ox + bx[0], oy + bx[1], bx[2], bx[3], 6, col);
+        draw_text_centered(fb, ox + bx[0] + bx[2] / 2, oy + bx[1] + 3,
+                           menu_labels[e - JE_M1], COL_TEXT, 1);
+        break;
+    }
+    case JE_STICK:
+        /* Stick base circle */
+        draw_circle(fb, ox + 220, oy + 135, 50, COL_STICK_BASE);
+        /* Stick shaft */
+        draw_rect(fb, ox + 213, oy + 60, 14, 75, COL_STICK);
+        /* Stick ball */
+        draw_circle(fb, ox + 220 + sdx, oy + 55 + sdy, 22, col);
+        break;
+    }
+}
+
+static void draw_joystick(Framebuffer *fb, App *app, int ox, int oy)
+{
+    draw_joystick_body(fb, ox, oy);
+
+    draw_joystick_elem(fb, ox, oy, JE_LFIRE, elem_color(app, 0, COL_BTN_FIRE), 0, 0);
+    draw_joystick_elem(fb, ox, oy, JE_RFIRE, elem_color(app, 1, COL_BTN_FIRE), 0, 0);
+    draw_joystick_elem(fb, ox, oy, JE_STICK, stick_color(app), 0, 0);
+
+    /* Stick direction labels */
+    if (app->state == STATE_MAPPING && app->cur_map == 8) {
+        /* leftx: show L/R arrows */
+        draw_text(fb, ox + 155, oy + 48, "<", COL_HIGHLIGHT, 2);
+        draw_text(fb, ox + 262, oy + 48, ">", COL_HIGHLIGHT, 2);
+    }
+    if (app->state == STATE_MAPPING && app->cur_map == 9) {
+        /* lefty: show U/D arrows */
+        draw_text_centered(fb, ox + 220, oy + 15, "^", COL_HIGHLIGHT, 2);
+        draw_text_centered(fb, ox + 220, oy + 185, "v", COL_HIGHLIGHT, 2);
+    }
+
+    draw_joystick_elem(fb, ox, oy, JE_LTRI, elem_color(app, 2, COL_BTN), 0, 0);
+    draw_joystick_elem(fb, ox, oy, JE_RTRI, elem_color(app, 3, COL_BTN), 0, 0);
+
+    /* Menu buttons 1-4 */
+    for (int i = 0; i < 4; i++)
+        draw_joystick_elem(fb, ox, oy, JE_M1 + i, elem_color(app, 4 + i, COL_BTN),
+                           0, 0);
+}
+
+/* ================================================================
+ * Directory browser
+ * ================================================================ */
+
+#define BROWSER_VISIBLE 18
+
+static const char *browser_export_label = ">> Export here <<";
+
+/* Name of row i; *is_dir is 0 only for the export action */
+static const char *browser_row(const DirBrowser *b, int i, int *is_dir)
+{
+    *is_dir = 1;
+    if (b->has_parent && i == 0)
+        return "..";
+    if (i == b->count - 1) {
+        *is_dir = 0;
+        return browser_export_label;
+    }
+    return b->names + b->index[i - b->has_parent];
+}
+
+static __thread const char *g_sort_names;  /* arena base for browser_name_cmp */
+
+static int browser_name_cmp(const void *a, const void *b)
+{
+    return strcasecmp(g_sort_names + *(const uint32_t *)a,
+                      g_sort_names + *(const uint32_t *)b);
+}
+
+static void browser_close(DirBrowser *b)
+{
+    if (b->dir) closedir(b->dir);
+    b->dir = NULL;
+}
+
+static void browser_free(DirBrowser *b)
+{
+    browser_close(b);
+    free(b->names);
+    free(b->index);
+    b->names = NULL;
+    b->index = NULL;
+    b->names_cap = 0;
+    b->index_cap = 0;
+}
+
+/* Append a name to the arena, returning its offset (or -1) */
+static long browser_add_name(DirBrowser *b, const char *name)
+{
+    size_t len = strlen(name) + 1;
+    if (b->names_len + len > b->names_cap) {
+        size_t cap = b->names_cap ? b->names_cap * 2 : 4096;
+        while (cap < b->names_len + len) cap *= 2;
+        char *n = realloc(b->names, cap);
+        if (!n) return -1;
+        b->names = n;
+        b->names_cap = cap;
+    }
+    memcpy(b->names + b->names_len, name, len);
+    b->names_len += len;
+    return (long)(b->names_len - len);
+}
+
+/* Copy a valid cached listing of path into b. Returns 1 on a hit. */
+static int dir_cache_get(DirCache *dc, const char *path, DirBrowser *b)
+{
+    struct stat st;
+    int hit = 0;
+
+    if (stat(path, &st) < 0) return 0;
+
+    pthread_mutex_lock(&dc->lock);
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++) {
+        DirCacheEntry *e = &dc->slots[i];
+        if (strcmp(e->path, path) != 0) continue;
+        if (e->mtime.tv_sec != st.st_mtim.tv_sec ||
+            e->mtime.tv_nsec != st.st_mtim.tv_nsec)
+            break;  /* stale; a fresh scan will replace it */
+
+        if (b->names_cap < e->names_len) {
+            char *names = realloc(b->names, e->names_len);
+            if (!names) break;
+            b->names = names;
+            b->names_cap = e->names_len;
+        }
+        if (b->index_cap < e->num_dirs) {
+            uint32_t *index = realloc(b->index, e->num_dirs * sizeof(*index));
+            if (!index) break;
+            b->index = index;
+            b->index_cap = e->num_dirs;
+        }
+
+        memcpy(b->names, e->names, e->names_len);
+        memcpy(b->index, e->index, e->num_dirs * sizeof(*b->index));
+        b->names_len = e->names_len;
+        b->num_dirs = e->num_dirs;
+        b->count = b->has_parent + b->num_dirs + 1;
+        b->mtime = e->mtime;
+        b->complete = 1;
+        e->last_used = ++dc->clock;
+        hit = 1;
+        break;
+    }
+    pthread_mutex_unlock(&dc->lock);
+    return hit;
+}
+
+/* Store b's complete listing, replacing the same path or the LRU slot */
+static void dir_cache_put(DirCache *dc, const DirBrowser *b)
+{
+    char *names = malloc(b->names_len ? b->names_len : 1);
+    uint32_t *index = malloc(b->num_dirs ? b->num_dirs * sizeof(*index) : 1);
+    if (!names || !index) { free(names); free(index); return; }
+    memcpy(names, b->names, b->names_len);
+    memcpy(index, b->index, b->num_dirs * sizeof(*index));
+
+    pthread_mutex_lock(&dc->lock);
+    DirCacheEntry *e = &dc->slots[0];
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++) {
+        if (strcmp(dc->slots[i].path, b->path) == 0) { e = &dc->slots[i]; break; }
+        if (dc->slots[i].last_used < e->last_used) e = &dc->slots[i];
+    }
+    free(e->names);
+    free(e->index);
+    snprintf(e->path, sizeof(e->path), "%s", b->path);
+    e->mtime = b->mtime;
+    e->names = names;
+    e->names_len = b->names_len;
+    e->index = index;
+    e->num_dirs = b->num_dirs;
+    e->last_used = ++dc->clock;
+    pthread_mutex_unlock(&dc->lock);
+}
+
+/* Ask the worker to list path; a newer request replaces a pending one */
+static void dir_cache_prefetch(DirCache *dc, const char *path)
+{
+    if (!dc->running) return;
+    pthread_mutex_lock(&dc->lock);
+    snprintf(dc->want, sizeof(dc->want), "%s", path);
+    pthread_cond_signal(&dc->cond);
+    pthread_mutex_unlock(&dc->lock);
+}
+
+/* The whole directory has been read */
+static void browser_finish(DirBrowser *b)
+{
+    b->complete = 1;
+    if (b->cache)
+        dir_cache_put(b->cache, b);
+}
+
+/* Read up to one page of entries and merge them into the sorted index.
+ * The highlighted row keeps pointing at the same entry. */
+static void browser_load_page(DirBrowser *b)
+{
+    uint32_t page[BROWSER_PAGE];
+    int n = 0;
+    struct dirent *entry;
+    struct stat st;
+
+    if (!b->dir) return;
+
+    entry = NULL;
+    while (n < BROWSER_PAGE && (entry = readdir(b->dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        int is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+            is_dir = fstatat(dirfd(b->dir), entry->d_name, &st, 0) == 0 &&
+                     S_ISDIR(st.st_mode);
+        if (!is_dir) continue;
+
+        long off = browser_add_name(b, entry->d_name);
+        if (off < 0) break;
+        page[n++] = (uint32_t)off;
+    }
+    int eof = entry == NULL;
+    if (n < BROWSER_PAGE)
+        browser_close(b);  /* end of directory (or out of memory) */
+    if (n == 0) {
+        if (eof) browser_finish(b);
+        return;
+    }
+
+    if (b->num_dirs + n > b->index_cap) {
+        int cap = b->index_cap ? b->index_cap * 2 : 256;
+        while (cap < b->num_dirs + n) cap *= 2;
+        uint32_t *idx = realloc(b->index, cap * sizeof(*idx));
+        if (!idx) { browser_close(b); return; }
+        b->index = idx;
+        b->index_cap = cap;
+    }
+
+    g_sort_names = b->names;
+    qsort(page, n, sizeof(page[0]), browser_name_cmp);
+
+    /* merge from the back, tracking where the selected entry lands */
+    int sel = b->selected - b->has_parent;  /* == num_dirs on export row */
+    int new_sel = sel < 0 ? sel : sel + n;
+    int i = b->num_dirs - 1, j = n - 1, k = b->num_dirs + n - 1;
+    while (j >= 0) {
+        if (i >= 0 && strcasecmp(b->names + b->index[i],
+                                 b->names + page[j]) > 0) {
+            if (i == sel) new_sel = k;
+            b->index[k--] = b->index[i--];
+        } else {
+            b->index[k--] = page[j--];
+        }
+    }
+    if (sel >= 0 && sel <= i)
+        new_sel = sel;  /* landed before every inserted entry */
+
+    b->num_dirs += n;
+    b->count = b->has_parent + b->num_dirs + 1;
+    b->scroll += new_sel - sel;
+    b->selected = new_sel + b->has_parent;
+    if (b->scroll > b->selected) b->scroll = b->selected;
+    if (b->scroll < b->selected - BROWSER_VISIBLE + 1)
+        b->scroll = b->selected - BROWSER_VISIBLE + 1;
+    if (b->scroll < 0) b->scroll = 0;
+
+    if (eof) browser_finish(b);
+}
+
+/* Open a directory and show its first page; the rest streams in */
+static void browser_load(DirBrowser *b, const char *path)
+{
+    char newpath[MAX_PATH_LEN];
+
+    snprintf(newpath, sizeof(newpath), "%s", path);  /* may alias b->path */
+    browser_close(b);
+    memcpy(b->path, newpath, sizeof(b->path));
+    b->names_len = 0;
+    b->num_dirs = 0;
+    b->selected = 0;
+    b->scroll = 0;
+    b->has_parent = strcmp(b->path, "/") != 0;
+    b->count = b->has_parent + 1;
+    b->complete = 0;
+
+    if (b->cache && dir_cache_get(b->cache, b->path, b))
+        return;
+
+    b->dir = opendir(b->path);
+    if (!b->dir) return;
+    struct stat st;
+    if (fstat(dirfd(b->dir), &st) == 0)
+        b->mtime = st.st_mtim;
+    browser_load_page(b);
+}
+
+/* Filesystem path of row i; returns -1 for the export action */
+static int browser_row_path(const DirBrowser *b, int i, char *out, size_t sz)
+{
+    int is_dir;
+    const char *name = browser_row(b, i, &is_dir);
+
+    if (!is_dir) return -1;
+    if (b->has_parent && i == 0) {
+        snprintf(out, sz, "%s", b->path);
+        char *slash = strrchr(out, '/');
+        if (slash && slash != out) *slash = '\0';
+        else snprintf(out, sz, "/");
+    } else if (strcmp(b->path, "/") == 0) {
+        snprintf(out, sz, "/%.250s", name);
+    } else {
+        snprintf(out, sz, "%.250s/%.250s", b->path, name);
+    }
+    return 0;
+}
+
+/* Warm the cache for whatever the highlighted row would open */
+static void browser_prefetch_selected(DirBrowser *b)
+{
+    char path[MAX_PATH_LEN];
+    if (b->cache && browser_row_path(b, b->selected, path, sizeof(path)) == 0)
+        dir_cache_prefetch(b->cache, path);
+}
+
+static void *dir_prefetch_worker(void *arg)
+{
+    DirCache *dc = arg;
+    DirBrowser tmp;
+    char path[MAX_PATH_LEN];
+
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.cache = dc;  /* a cache hit skips the scan, a full scan stores it */
+
+    pthread_mutex_lock(&dc->lock);
+    for (;;) {
+        while (dc->want[0] == '\0' && !dc->stop)
+            pthread_cond_wait(&dc->cond, &dc->lock);
+        if (dc->stop)
+            break;
+        memcpy(path, dc->want, sizeof(path));
+        dc->want[0] = '\0';
+        pthread_mutex_unlock(&dc->lock);
+
+        browser_load(&tmp, path);
+        while (tmp.dir && !dc->stop)
+            browser_load_page(&tmp);
+        browser_close(&tmp);
+
+        pthread_mutex_lock(&dc->lock);
+    }
+    pthread_mutex_unlock(&dc->lock);
+    browser_free(&tmp);
+    return NULL;
+}
+
+static void dir_cache_start(DirCache *dc)
+{
+    pthread_mutex_init(&dc->lock, NULL);
+    pthread_cond_init(&dc->cond, NULL);
+    dc->running = start_worker(&dc->thread, dir_prefetch_worker, dc) == 0;
+}
+
+static void dir_cache_stop(DirCache *dc)
+{
+    if (dc->running) {
+        pthread_mutex_lock(&dc->lock);
+        dc->stop = 1;
+        pthread_cond_signal(&dc->cond);
+        pthread_mutex_unlock(&dc->lock);
+        pthread_join(dc->thread, NULL);
+        dc->running = 0;
+    }
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++) {
+        free(dc->slots[i].names);
+        free(dc->slots[i].index);
+    }
+}
+
+/* ================================================================
+ * Navigation input (using mapped controls)
+ * ================================================================ */
+
+/* The selected pad, THEJOYSTICK and the keyboards are read as one
+ * timestamp-ordered stream, so a later direction overrides an earlier
+ * one whichever device it came from. *key is the first key pressed on
+ * a keyboard (0 if none); the pass stops before a second one, which is
+ * left buffered for the next frame together with what came after it. */
+static int read_nav_input(App *app, int *dy, int *dx, int *btn_a, int *btn_b,
+                           int *btn_start, int *key)
+{
+    Controller *c = &app->controllers[app->sel_ctrl];
+    int thec64_fd = app->thec64_nav_idx >= 0 ?
+                    app->controllers[app->thec64_nav_idx].fd : -1;
+    const struct input_event *next;
+    struct input_event ev;
+    int fd;
+
+    *dy = 0; *dx = 0; *btn_a = 0; *btn_b = 0; *btn_start = 0; *key = 0;
+
+    merge_begin(&app->merge);
+    merge_add(&app->merge, c->fd);
+    if (thec64_fd >= 0)
+        merge_add(&app->merge, thec64_fd);
+    merge_add_ready(&app->merge, app->kbd_epfd);
+
+    while ((next = merge_peek(&app->merge, &fd)) != NULL) {
+        int kbd = fd != c->fd && fd != thec64_fd;
+        if (kbd && *key && next->type == EV_KEY && next->value == 1)
+            break;
+        merge_next(&app->merge, &ev, &fd);
+        if (kbd) {
+            if (ev.type == EV_KEY && ev.value == 1)
+                *key = ev.code;
+            continue;
+        }
+        if (fd == thec64_fd) {
+            thec64_nav_event(&ev, dy, dx, btn_a, btn_b, btn_start);
+            continue;
+        }
+        if (ev.type == EV_KEY && ev.value == 1) {
+            int idx = ctrl_button(c, ev.code);
+            if (idx < 0) continue;
+            /* compare with mapped buttons */
+            if (app->mappings[0].mapped_type == MAP_BUTTON &&
+                idx == app->mappings[0].mapped_index) *btn_a = 1; /* Left Fire = confirm */
+            if (app->mappings[4].mapped_type == MAP_BUTTON &&
+                idx == app->mappings[4].mapped_index) *btn_a = 1;
+            if (app->mappings[5].mapped_type == MAP_BUTTON &&
+                idx == app->mappings[5].mapped_index) *btn_b = 1;
+            if (app->mappings[7].mapped_type == MAP_BUTTON &&
+                idx == app->mappings[7].mapped_index) *btn_start = 1;
+        }
+        else if (ev.type == EV_ABS) {
+            /* lefty (index 9) for vertical nav */
+            MappingEntry *my = &app->mappings[9];
+            int axis = ctrl_axis_sample(c, ev.code, ev.value);
+            int hat = ctrl_hat(c, ev.code);
+            if (my->mapped_type == MAP_AXIS && axis >= 0 &&
+                axis == my->mapped_index)
+                *dy = ctrl_axis_dir(c, axis, ev.value);
+            if (my->mapped_type == MAP_HAT && hat >= 0 && hat == my->mapped_index) {
+                if (ev.value < 0) *dy = -1;
+                else if (ev.value > 0) *dy = 1;
+                else *dy = 0;
+            }
+            /* leftx (index 8) for horizontal nav */
+            MappingEntry *mx = &app->mappings[8];
+            if (mx->mapped_type == MAP_AXIS && axis >= 0 &&
+                axis == mx->mapped_index)
+                *dx = ctrl_axis_dir(c, axis, ev.value);
+            if (mx->mapped_type == MAP_HAT && hat >= 0 && hat == mx->mapped_index) {
+                if (ev.value < 0) *dx = -1;
+                else if (ev.value > 0) *dx = 1;
+                else *dx = 0;
+            }
+        }
+    }
+
+    return (*dy || *dx || *btn_a || *btn_b || *btn_start);
+}
+
+/* ================================================================
+ * Mapping input detection
+ * ================================================================ */
+
+static int poll_mapping_input(App *app, MappingEntry *entry)
+{
+    Controller *c = &app->controllers[app->sel_ctrl];
+    struct input_event ev;
+
+    while (read(c->fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
+        if (ev.type == EV_KEY && ev.value == 1) {
+            int idx = ctrl_button(c, ev.code);
+            if (idx >= 0) {
+                entry->mapped_type = MAP_BUTTON;
+                entry->mapped_index = idx;
+                return 1;
+            }
+        }
+        else if (ev.type == EV_ABS) {
+            if (ev.code >= ABS_HAT0X && ev.code <= ABS_HAT3Y && ev.value != 0) {
+                int hat = (ev.code - ABS_HAT0X) / 2;
+                int mask;
+                if ((ev.code - ABS_HAT0X) % 2 == 0)
+                    mask = (ev.value < 0) ? 8 : 2;   /* L=8, R=2 */
+                else
+                    mask = (ev.value < 0) ? 1 : 4;   /* U=1, D=4 */
+                entry->mapped_type = MAP_HAT;
+                entry->mapped_index = hat;
+                entry->hat_mask = mask;
+                return 1;
+            }
+            else {
+                int aidx = ctrl_axis_sample(c, ev.code, ev.value);
+                if (aidx >= 0 && ctrl_axis_dir(c, aidx, ev.value) != 0) {
+                    entry->mapped_type = MAP_AXIS;
+                    entry->mapped_index = aidx;
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* ================================================================
+ * State: detect controller
+ * ================================================================ */
+
+/* Start mapping controllers[i] */
+static void detect_select(App *app, int i)
+{
+    app->sel_ctrl = i;
+    probe_controller(&app->controllers[i]);
+    find_thec64_nav(app);
+    /* drain all controllers */
+    for (int j = 0; j < app->num_controllers; j++)
+        drain_events(app, &app->controllers[j]);
+    app->state = STATE_MAPPING;
+    app->cur_map = 0;
+    app->redo_single = -1;
+    tlm_session_begin(&app->tlm, &app->controllers[i]);
+    tlm_prompt_begin(&app->tlm);
+}
+
+static void update_detect(App *app)
+{
+    uint64_t now = time_ms();
+
+    /* Periodic rescan */
+    if (now - app->last_scan > RESCAN_MS) {
+        scan_controllers(app);
+        app->last_scan = now;
+    }
+
+    /* Merge every controller with pending input and the keyboards, so
+     * the pad whose button went down first is picked, not the lowest
+     * index. Keyboards have no controller slot. */
+    struct input_event ev;
+    int fd;
+
+    merge_begin(&app->merge);
+    merge_add_ready(&app->merge, app->ctrl_epfd);
+    merge_add_ready(&app->merge, app->kbd_epfd);
+
+    while (merge_next(&app->merge, &ev, &fd)) {
+        int i = ctrl_slot(app, fd);
+        if (i < 0) {
+            /* Scroll the controller list from the keyboard */
+            if (ev.type != EV_KEY || ev.value != 1) continue;
+            if (ev.code == KEY_UP) app->detect_scroll--;
+            if (ev.code == KEY_DOWN) app->detect_scroll++;
+            if (ev.code == KEY_PAGEUP) app->detect_scroll -= 8;
+            if (ev.code == KEY_PAGEDOWN) app->detect_scroll += 8;
+            continue;
+        }
+        Controller *c = &app->controllers[i];
+        app->detect_active = i;
+        app->detect_active_time = now;
+        /* Feed axis motion to pads already probed. An unprobed one is
+         * left alone: probing now would seed its calibration from a
+         * stick that is moving. */
+        if (ev.type == EV_ABS) {
+            if (c->probed)
+                ctrl_axis_sample(c, ev.code, ev.value);
+            continue;
+        }
+        if (ev.type == EV_KEY && ev.value == 1) {
+            detect_select(app, i);
+            return;
+        }
+    }
+}
+
+static void render_detect(App *app)
+{
+    Framebuffer *fb = &app->fb;
+    int cx = fb->width / 2;
+
+    draw_text_centered(fb, cx, 60, "THEC64 GAMEPAD MAPPER", COL_TEXT_TITLE, 3);
+
+    draw_text_centered(fb, cx, 180, "Press any button on the controller",
+                        COL_TEXT, 2);
+    draw_text_centered(fb, cx, 220, "you want to map", COL_TEXT, 2);
+
+    int y = 320;
+    if (app->num_controllers == 0) {
+        draw_text_centered(fb, cx, y,
+                            "No controllers detected. Connect a USB controller.",
+                            COL_TEXT_DIM, 1);
+    } else {
+        char buf[512];
+        int rows = (fb->height - y - 40) / DETECT_ROW_H;
+        if (rows < 1) rows = 1;
+
+        /* keep the pad that last sent input in view */
+        int active = app->detect_active >= 0 &&
+                     time_ms() - app->detect_active_time < DETECT_ACTIVE_MS ?
+                     app->detect_active : -1;
+        if (active >= 0 && active < app->detect_scroll)
+            app->detect_scroll = active;
+        if (active >= app->detect_scroll + rows)
+            app->detect_scroll = active - rows + 1;
+        if (app->detect_scroll > app->num_controllers - rows)
+            app->detect_scroll = app->num_controllers - rows;
+        if (app->detect_scroll < 0)
+            app->detect_scroll = 0;
+
+        int first = app->detect_scroll;
+        int last = first + rows < app->num_controllers ?
+                   first + rows : app->num_controllers;
+        if (app->num_controllers > rows)
+            snprintf(buf, sizeof(buf),
+                     "Detected controllers: %d-%d of %d (Up/Down to scroll)",
+                     first + 1, last, app->num_controllers);
+        else
+            snprintf(buf, sizeof(buf), "Detected controllers:");
+        draw_text_centered(fb, cx, y - 30, buf, COL_TEXT, 1);
+
+        for (int i = first; i < last; i++) {
+            int ry = y + (i - first) * DETECT_ROW_H;
+            if (i == active)
+                draw_rect(fb, 90, ry - 2, fb->width - 180, DETECT_ROW_H - 2,
+                          COL_SELECTED);
+            snprintf(buf, sizeof(buf), "%d. %.250s  [%.200s]",
+                     i + 1, app->controllers[i].name, app->controllers[i].path);
+            draw_text(fb, 100, ry, buf, COL_TEXT, 1);
+        }
+    }
+}
+
+/* ================================================================
+ * State: mapping
+ * ================================================================ */
+
+/* The current prompt has its value: go to the next one or to review */
+static void mapping_advance(App *app)
+{
+    tlm_prompt_done(&app->tlm, app->cur_map);
+    mappings_changed(app);
+
+    if (app->redo_single >= 0) {
+        /* was redoing a single mapping, go back to review */
+        app->redo_single = -1;
+        app->state = STATE_REVIEW;
+        return;
+    }
+
+    app->cur_map++;
+    if (app->cur_map >= NUM_MAPPINGS) {
+        app->state = STATE_REVIEW;
+        app->review_sel = 0;
+        /* generate mapping string */
+        review_model_update(app);
+    } else {
+        tlm_prompt_begin(&app->tlm);
+    }
+}
+
+static void update_mapping(App *app)
+{
+    MappingEntry *m = &app->mappings[app->cur_map];
+    if (poll_mapping_input(app, m)) {
+        tlm_prompt_done(&app->tlm, app->cur_map);  /* before the debounce */
+        drain_events(app, &app->controllers[app->sel_ctrl]);
+        usleep(DEBOUNCE_MS * 1000);
+        drain_events(app, &app->controllers[app->sel_ctrl]);
+        mapping_advance(app);
+    }
+}
+
+static void render_mapping(App *app)
+{
+    Framebuffer *fb = &app->fb;
+    int cx = fb->width / 2;
+    MappingEntry *m = &app->mappings[app->cur_map];
+    char buf[256];
+
+    /* Header bar */
+    draw_rect(fb, 0, 0, fb->width, 36, COL_HEADER_BG);
+    snprintf(buf, sizeof(buf), "Mapping: %.200s (%d/%d)",
+             app->controllers[app->sel_ctrl].name,
+             app->cur_map + 1, NUM_MAPPINGS);
+    draw_text(fb, 16, 10, buf, COL_TEXT, 1);
+
+    snprintf(buf, sizeof(buf), "GUID: %s", app->controllers[app->sel_ctrl].guid);
+    draw_text(fb, fb->width - text_width(buf, 1) - 16, 10, buf, COL_TEXT_DIM, 1);
+
+    /* Joystick graphic */
+    int jx = cx - JOY_W / 2;
+    int jy = 50;
+    draw_joystick(fb, app, jx, jy);
+
+    /* Prompt */
+    int py = jy + JOY_H + 20;
+    snprintf(buf, sizeof(buf), ">>> %s <<<", m->prompt);
+    draw_text_centered(fb, cx, py, buf, app->blink ? COL_HIGHLIGHT : COL_TEXT, 2);
+
+    /* Sub-label */
+    snprintf(buf, sizeof(buf), "for: %s (%s)", m->the64_label, m->gcdb_name);
+    draw_text_centered(fb, cx, py + 40, buf, COL_TEXT_DIM, 1);
+
+    /* Already mapped summary */
+    int sy = py + 70;
+    draw_text(fb, 100, sy, "Mapped so far:", COL_TEXT_DIM, 1);
+    sy += 20;
+    for (int i = 0; i < app->cur_map; i++) {
+        MappingEntry *mi = &app->mappings[i];
+        switch (mi->mapped_type) {
+        case MAP_BUTTON:
+            snprintf(buf, sizeof(buf), "  %s = b%d", mi->gcdb_name,
+                     mi->mapped_index);
+            break;
+        case MAP_AXIS:
+            snprintf(buf, sizeof(buf), "  %s = a%d", mi->gcdb_name,
+                     mi->mapped_index);
+            break;
+        case MAP_HAT:
+            snprintf(buf, sizeof(buf), "  %s = h%d.%d", mi->gcdb_name,
+                     mi->mapped_index, mi->hat_mask);
+            break;
+        default:
+            snprintf(buf, sizeof(buf), "  %s = (none)", mi->gcdb_name);
+            break;
+        }
+        draw_text(fb, 100, sy + i * 18, buf, COL_MAPPED, 1);
+    }
+}
+
+/* ================================================================
+ * State: test
+ *
+ * Lights up the graphic as mapped inputs are used. After the first full
+ * frame only elements whose state changed are redrawn and flipped.
+ * ================================================================ */
+
+#define TEST_EXIT_HOLD_MS  1000
+
+static void test_enter(App *app)
+{
+    Controller *c = &app->controllers[app->sel_ctrl];
+    TestView *t = &app->test;
+    uint32_t *base = t->base;
+
+    memset(t, 0, sizeof(*t));
+    t->base = base;
+    for (int i = 0; i < c->num_axes; i++)
+        t->axis_val[i] = c->axes[i].center;
+    /* event age is only meaningful against time_us() on the same clock */
+    t->mono_clock = c->mono_clock;
+
+    drain_nav_events(app);
+    app->state = STATE_TEST;
+}
+
+static void test_leave(App *app)
+{
+    free(app->test.base);
+    app->test.base = NULL;
+    app->test.drawn = 0;
+    app->state = STATE_REVIEW;
+    drain_nav_events(app);
+}
+
+/* Stick ball displacement in pixels for leftx (8) or lefty (9) */
+static int test_stick_offset(App *app, int map_idx)
+{
+    Controller *c = &app->controllers[app->sel_ctrl];
+    MappingEntry *m = &app->mappings[map_idx];
+    TestView *t = &app->test;
+
+    switch (m->mapped_type) {
+    case MAP_AXIS: {
+        if (m->mapped_index >= c->num_axes) return 0;
+        const AxisInfo *a = &c->axes[m->mapped_index];
+        int delta = t->axis_val[m->mapped_index] - a->center;
+        int travel = delta < 0 ? a->center - a->min : a->max - a->center;
+        if (travel <= 0) return 0;
+        int d = (int)((int64_t)delta * STICK_TRAVEL / travel);
+        if (d < -STICK_TRAVEL) d = -STICK_TRAVEL;
+        if (d > STICK_TRAVEL) d = STICK_TRAVEL;
+        return d;
+    }
+    case MAP_HAT: {
+        if (m->mapped_index >= c->num_hats) return 0;
+        uint8_t bits = t->hat_bits[m->mapped_index];
+        if (map_idx == 8)
+            return (bits & 8) ? -STICK_TRAVEL : (bits & 2) ? STICK_TRAVEL : 0;
+        return (bits & 1) ? -STICK_TRAVEL : (bits & 4) ? STICK_TRAVEL : 0;
+    }
+    case MAP_BUTTON:
+        return t->active[map_idx] ? STICK_TRAVEL : 0;
+    default:
+        return 0;
+    }
+}
+
+static void update_test(App *app)
+{
+    Controller *c = &app->controllers[app->sel_ctrl];
+    TestView *t = &app->test;
+    struct input_event ev;
+
+    while (read(c->fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
+        int known = 0;
+        if (ev.type == EV_KEY) {
+            int b = ctrl_button(c, ev.code);
+            if (b >= 0) {
+                t->btn_down[b] = ev.value != 0;
+                snprintf(t->last_desc, sizeof(t->last_desc), "b%d %s", b,
+                         ev.value ? "down" : "up");
+                known = 1;
+            }
+        } else if (ev.type == EV_ABS) {
+            int h = ctrl_hat(c, ev.code);
+            int a = ctrl_axis_sample(c, ev.code, ev.value);
+            if (h >= 0) {
+                int x_axis = (ev.code - ABS_HAT0X) % 2 == 0;
+                uint8_t clear = x_axis ? (2 | 8) : (1 | 4);
+                uint8_t set = x_axis ? (ev.value < 0 ? 8 : ev.value > 0 ? 2 : 0)
+                                     : (ev.value < 0 ? 1 : ev.value > 0 ? 4 : 0);
+                t->hat_bits[h] = (t->hat_bits[h] & ~clear) | set;
+                snprintf(t->last_desc, sizeof(t->last_desc), "h%d.%d", h,
+                         t->hat_bits[h]);
+                known = 1;
+            } else if (a >= 0) {
+                t->axis_val[a] = ev.value;
+                snprintf(t->last_desc, sizeof(t->last_desc), "a%d %d", a,
+                         ev.value);
+                known = 1;
+            }
+        }
+        if (known)
+            t->last_event_us = t->mono_clock ? event_time_us(&ev) : time_us();
+    }
+
+    for (int i = 0; i < NUM_MAPPINGS; i++) {
+        MappingEntry *m = &app->mappings[i];
+        switch (m->mapped_type) {
+        case MAP_BUTTON:
+            t->active[i] = m->mapped_index < INT8_MAX &&
+                           t->btn_down[m->mapped_index];
+            break;
+        case MAP_HAT:
+            t->active[i] = m->mapped_index < c->num_hats &&
+                           (t->hat_bits[m->mapped_index] & m->hat_mask) != 0;
+            break;
+        case MAP_AXIS:
+            t->active[i] = m->mapped_index < c->num_axes &&
+                ctrl_axis_dir(c, m->mapped_index,
+                              t->axis_val[m->mapped_index]) != 0;
+            break;
+        default:
+            t->active[i] = 0;
+            break;
+        }
+    }
+    t->stick_dx = test_stick_offset(app, 8);
+    t->stick_dy = test_stick_offset(app, 9);
+
+    /* The pad under test cannot navigate, so leave by holding Menu 4,
+     * from the keyboard or with THEJOYSTICK */
+    uint64_t now = time_ms();
+    if (!t->active[7])
+        t->hold_start = 0;
+    else if (!t->hold_start)
+        t->hold_start = now;
+    else if (now - t->hold_start >= TEST_EXIT_HOLD_MS)
+        { test_leave(app); return; }
+
+    int key = read_keyboard(app);
+    if (key == KEY_ESC || key == KEY_Q || key == KEY_BACKSPACE)
+        { test_leave(app); return; }
+
+    int dy = 0, dx = 0, ba = 0, bb = 0, bs = 0;
+    if (read_thec64_nav(app, &dy, &dx, &ba, &bb, &bs) && (ba || bb || bs))
+        test_leave(app);
+}
+
+/* Describe the live value of a stick mapping */
+static void test_axis_text(App *app, int map_idx, char *out, size_t sz)
+{
+    MappingEntry *m = &app->mappings[map_idx];
+    TestView *t = &app->test;
+    char val[32];
+
+    format_mapping_value(m, val, sizeof(val));
+    if (m->mapped_type == MAP_AXIS && m->mapped_index < MAX_AXES) {
+        const AxisInfo *a = &app->controllers[app->sel_ctrl].axes[m->mapped_index];
+        snprintf(out, sz, "%-8s %-5s value %7d  stick %+3d px  centre %d dz %d",
+                 m->gcdb_name, val, t->axis_val[m->mapped_index],
+                 map_idx == 8 ? t->stick_dx : t->stick_dy,
+                 a->center, a->deadzone);
+    }
+    else
+        snprintf(out, sz, "%-8s %-5s %s", m->gcdb_name, val[0] ? val : "-",
+                 t->active[map_idx] ? "active" : "");
+}
+
+static void render_test(App *app)
+{
+    Framebuffer *fb = &app->fb;
+    TestView *t = &app->test;
+    int full = !t->drawn;
+    char text[3][128];
+
+    if (full) {
+        t->ox = fb->width / 2 - JOY_W / 2;
+        t->oy = 50;
+
+        fb_clear(fb, COL_BG);
+        draw_rect(fb, 0, 0, fb->width, 36, COL_HEADER_BG);
+        snprintf(text[0], sizeof(text[0]), "Test Mapping: %.80s",
+                 app->controllers[app->sel_ctrl].name);
+        draw_text(fb, 16, 10, text[0], COL_TEXT_TITLE, 1);
+        draw_text(fb, 60, fb->height - 40,
+                  "Hold Menu 4 for 1s, press Esc/Q or a THEJOYSTICK button "
+                  "to return",
+                  COL_TEXT_DIM, 1);
+        draw_joystick_body(fb, t->ox, t->oy);
+
+        /* keep the bare body so elements can be erased individually */
+        if (!t->base)
+            t->base = malloc((size_t)JOY_W * JOY_H * sizeof(uint32_t));
+        for (int row = 0; t->base && row < JOY_H; row++) {
+            int y = t->oy + row;
+            int w = fb->width - t->ox < JOY_W ? fb->width - t->ox : JOY_W;
+            if (y >= fb->height || w <= 0) break;
+            memcpy(t->base + row * JOY_W, fb->backbuf + y * fb->stride_px + t->ox,
+                   (size_t)w * sizeof(uint32_t));
+        }
+
+        for (int e = 0; e < NUM_JOY_ELEMS; e++)
+            t->drawn_active[e] = -1;
+        for (int i = 0; i < 3; i++)
+            t->drawn_text[i][0] = '\0';
+    }
+
+    for (int e = 0; e < NUM_JOY_ELEMS; e++) {
+        const int *bx = joy_elem_box[e];
+        int act = e == JE_STICK ? (t->active[8] || t->active[9]) : t->active[e];
+        if (e == JE_STICK && (t->stick_dx != t->drawn_dx ||
+                              t->stick_dy != t->drawn_dy))
+            t->drawn_active[e] = -1;
+        if (act == t->drawn_active[e])
+            continue;
+
+        /* erase to the bare body, then draw the element in its new state */
+        int x = t->ox + bx[0], y = t->oy + bx[1];
+        for (int row = 0; t->base && row < bx[3]; row++) {
+            if (y + row >= fb->height || x + bx[2] > fb->width) break;
+            memcpy(fb->backbuf + (y + row) * fb->stride_px + x,
+                   t->base + (bx[1] + row) * JOY_W + bx[0],
+                   (size_t)bx[2] * sizeof(uint32_t));
+        }
+        uint32_t col;
+        if (e == JE_STICK)
+            col = stick_color(app);
+        else
+            col = elem_color(app, e, e <= JE_RFIRE ? COL_BTN_FIRE : COL_BTN);
+        draw_joystick_elem(fb, t->ox, t->oy, e, col, t->stick_dx, t->stick_dy);
+
+        t->drawn_active[e] = act;
+        if (e == JE_STICK) {
+            t->drawn_dx = t->stick_dx;
+            t->drawn_dy = t->stick_dy;
+        }
+        if (!full)
+            fb_flip_rect(fb, x, y, bx[2], bx[3]);
+    }
+
+    /* live readouts below the graphic */
+    test_axis_text(app, 8, text[0], sizeof(text[0]));
+    test_axis_text(app, 9, text[1], sizeof(text[1]));
+    if (t->last_event_us) {
+        uint64_t now = time_us();
+        uint64_t age = now > t->last_event_us ? now - t->last_event_us : 0;
+        snprintf(text[2], sizeof(text[2]), "Last event: %-14s %6llu ms ago",
+                 t->last_desc, (unsigned long long)(age / 1000));
+    } else {
+        snprintf(text[2], sizeof(text[2]), "Last event: none yet");
+    }
+
+    int ty = t->oy + JOY_H + 20;
+    for (int i = 0; i < 3; i++, ty += 20) {
+        if (strcmp(text[i], t->drawn_text[i]) == 0)
+            continue;
+        draw_rect(fb, 60, ty, fb->width - 120, FONT_H, COL_BG);
+        draw_text(fb, 60, ty, text[i], i == 2 ? COL_TEXT_DIM : COL_TEXT, 1);
+        memcpy(t->drawn_text[i], text[i], sizeof(text[i]));
+        if (!full)
+            fb_flip_rect(fb, 60, ty, fb->width - 120, FONT_H);
+    }
+
+    if (full) {
+        fb_flip(fb);
+        t->drawn = 1;
+    }
+}
+
+/* ================================================================
+ * State: review
+ * ================================================================ */
+
+/* Helper: redo the currently selected mapping row */
+static void review_redo_selected(App *app)
+{
+    if (app->review_sel >= 0 && app->review_sel < NUM_MAPPINGS) {
+        app->redo_single = app->review_sel;
+        app->cur_map = app->review_sel;
+        app->mappings[app->cur_map].mapped_type = MAP_NONE;
+        mappings_changed(app);
+        app->state = STATE_MAPPING;
+        drain_nav_events(app);
+        app->tlm.cur.redos++;
+        tlm_prompt_begin(&app->tlm);
+    }
+}
+
+/* Helper: start mapping all over */
+static void review_restart(App *app)
+{
+    init_mappings(app->mappings);
+    mappings_changed(app);
+    app->cur_map = 0;
+    app->redo_single = -1;
+    app->state = STATE_MAPPING;
+    drain_nav_events(app);
+    app->tlm.cur.restarts++;
+    tlm_prompt_begin(&app->tlm);
+}
+
+/* Helper: back to the detect screen for the next controller */
+static void review_another(App *app)
+{
+    tlm_session_end(&app->tlm, TLM_END_ANOTHER);
+    init_mappings(app->mappings);
+    mappings_changed(app);
+    app->sel_ctrl = -1;
+    app->thec64_nav_idx = -1;
+    app->state = STATE_DETECT;
+    app->save_path[0] = '\0';
+    app->save_err = 0;
+}
+
+/* Helper: go to directory browser to save */
+static void review_save(App *app)
+{
+    browser_load(&app->browser, "/mnt");
+    browser_prefetch_selected(&app->browser);
+    app->state = STATE_BROWSE;
+    drain_nav_events(app);
+}
+
+static void update_review(App *app)
+{
+    int dy, dx, btn_a, btn_b, btn_start;
+    int key;
+    int got_ctrl = read_nav_input(app, &dy, &dx, &btn_a, &btn_b, &btn_start,
+                                  &key);
+
+    /* Keyboard input */
+    if (key == KEY_UP)    dy = -1;
+    if (key == KEY_DOWN)  dy = 1;
+    if (key == KEY_RIGHT) dx = 1;
+    if (key == KEY_1)     { review_redo_selected(app); return; }
+    if (key == KEY_2)     { review_save(app); return; }
+    if (key == KEY_3)     { review_restart(app); return; }
+    if (key == KEY_5)     { test_enter(app); return; }
+    if (key == KEY_4)     { review_another(app); return; }
+    if (key == KEY_Q || key == KEY_ESC) { app->state = STATE_EXIT; return; }
+
+    if (!got_ctrl && !key)
+        return;
+
+    /* Vertical navigation */
+    if (dy) {
+        app->review_sel += dy;
+        if (app->review_sel < 0) app->review_sel = 0;
+        if (app->review_sel >= REVIEW_TOTAL_ITEMS)
+            app->review_sel = REVIEW_TOTAL_ITEMS - 1;
+    }
+
+    /* Right on a mapping row (0..9) = redo that mapping */
+    if (dx > 0 && app->review_sel >= 0 && app->review_sel < NUM_MAPPINGS) {
+        review_redo_selected(app);
+        return;
+    }
+
+    /* Confirm on action rows or mapping rows */
+    if (btn_a || key == KEY_ENTER || key == KEY_SPACE) {
+        if (app->review_sel >= 0 && app->review_sel < NUM_MAPPINGS) {
+            /* selecting a mapping row = redo it */
+            review_redo_selected(app);
+            return;
+        }
+        if (app->review_sel == REVIEW_ACTION_SAVE) {
+            review_save(app);
+            return;
+        }
+        if (app->review_sel == REVIEW_ACTION_TEST) {
+            test_enter(app);
+            return;
+        }
+        if (app->review_sel == REVIEW_ACTION_RESTART) {
+            review_restart(app);
+            return;
+        }
+        if (app->review_sel == REVIEW_ACTION_ANOTHER) {
+            review_another(app);
+            return;
+        }
+        if (app->review_sel == REVIEW_ACTION_QUIT) {
+            app->state = STATE_EXIT;
+            return;
+        }
+    }
+
+    /* Shortcut buttons still work regardless of cursor position */
+    if (btn_b) {
+        if (app->review_sel >= 0 && app->review_sel < NUM_MAPPINGS) {
+            review_redo_selected(app);
+            return;
+        }
+    }
+    if (btn_start) {
+        review_save(app);
+        return;
+    }
+}
+
+static void render_review(App *app)
+{
+    Framebuffer *fb = &app->fb;
+    int cx = fb->width / 2;
+    char buf[256];
+
+    /* Header */
+    draw_rect(fb, 0, 0, fb->width, 36, COL_HEADER_BG);
+    draw_text(fb, 16, 10, "Review Mappings", COL_TEXT_TITLE, 1);
+
+    int y = 50;
+
+    ReviewModel *rm = &app->review;
+    review_model_update(app);
+
+    /* Column headers */
+    draw_text(fb, 60, y, "THE64 Input", COL_TEXT_DIM, 1);
+    draw_text(fb, 260, y, "Mapped To", COL_TEXT_DIM, 1);
+    draw_text(fb, 460, y, "gamecontrollerdb", COL_TEXT_DIM, 1);
+    if (rm->has_dupes)
+        draw_text(fb, 660, y, "Duplicate Assignment", COL_TEXT_DIM, 1);
+
+    y += 24;
+    draw_rect(fb, 50, y, fb->width - 100, 1, COL_BORDER);
+    y += 8;
+
+    for (int i = 0; i < NUM_MAPPINGS; i++) {
+        MappingEntry *m = &app->mappings[i];
+        int hl = (i == app->review_sel);
+
+        if (hl)
+            draw_rect(fb, 50, y - 2, fb->width - 100, 22, COL_SELECTED);
+
+        draw_text(fb, 60, y, m->the64_label, hl ? COL_TEXT_TITLE : COL_TEXT, 1);
+        draw_text(fb, 260, y, rm->mapped_to[i],
+                  hl ? COL_TEXT_TITLE : COL_TEXT, 1);
+        draw_text(fb, 460, y, rm->gcdb_value[i], COL_MAPPED, 1);
+
+        /* Show duplicate assignments for this row */
+        if (rm->dups[i][0] != '\0')
+            draw_text(fb, 660, y, rm->dups[i], COL_ERROR, 1);
+
+        y += 24;
+    }
+
+    /* Action buttons */
+    y += 12;
+    draw_rect(fb, 50, y, fb->width - 100, 1, COL_BORDER);
+    y += 10;
+
+    {
+        struct { int idx; const char *label; const char *key; uint32_t col; } actions[] = {
+            { REVIEW_ACTION_SAVE,    "Save to File",          "2", COL_SUCCESS },
+            { REVIEW_ACTION_TEST,    "Test Mapping",          "5", COL_TEXT },
+            { REVIEW_ACTION_RESTART, "Start Over",            "3", COL_HIGHLIGHT },
+            { REVIEW_ACTION_ANOTHER, "Map Another Controller","4", COL_TEXT },
+            { REVIEW_ACTION_QUIT,    "Quit",                  "Q", COL_ERROR },
+        };
+        for (int i = 0; i < (int)(sizeof(actions) / sizeof(actions[0])); i++) {
+            int hl = (app->review_sel == actions[i].idx);
+            if (hl)
+                draw_rect(fb, 50, y - 2, fb->width - 100, 22, COL_SELECTED);
+            snprintf(buf, sizeof(buf), "[%s] %s", actions[i].key, actions[i].label);
+            draw_text(fb, 70, y, buf,
+                      hl ? COL_TEXT_TITLE : actions[i].col, 1);
+            y += 24;
+        }
+    }
+
+    /* Help */
+    y += 6;
+    draw_rect(fb, 50, y, fb->width - 100, 1, COL_BORDER);
+    y += 8;
+    draw_text(fb, 60, y,
+              "Keyboard: Arrows=Navigate  Right/Enter=Redo  1=Redo sel  "
+              "2=Save  3=Restart  4=Another  5=Test  Q=Quit",
+              COL_TEXT_DIM, 1);
+    y += 16;
+    draw_text(fb, 60, y,
+              "Controller: Stick=Navigate  Right=Redo  LFire/A=Confirm  "
+              "B=Redo  Start=Save",
+              COL_TEXT_DIM, 1);
+
+    /* Save status */
+    if (app->save_pending) {
+        y += 16;
+        draw_text(fb, 60, y, "Saving...", COL_HIGHLIGHT, 1);
+    } else if (app->save_err) {
+        y += 16;
+        snprintf(buf, sizeof(buf), "Save failed: %.200s (%s)", app->save_path,
+                 strerror(app->save_err));
+        draw_text(fb, 60, y, buf, COL_ERROR, 1);
+    } else if (app->save_path[0] != '\0') {
+        y += 16;
+        snprintf(buf, sizeof(buf), "Saved to: %.200s", app->save_path);
+        draw_text(fb, 60, y, buf, COL_SUCCESS, 1);
+    }
+
+    /* GUID and full string */
+    y += 24;
+    snprintf(buf, sizeof(buf), "GUID: %s",
+             app->controllers[app->sel_ctrl].guid);
+    draw_text(fb, 60, y, buf, COL_TEXT, 1);
+
+    y += 24;
+    /* wrap mapping string display */
+    int mlen = strlen(app->mapping_str);
+    int chars_per_line = (fb->width - 120) / (FONT_W * 1);
+    int off = 0;
+    while (off < mlen) {
+        int chunk = mlen - off;
+        if (chunk > chars_per_line) chunk = chars_per_line;
+        while (chunk > 1 && off + chunk < mlen &&  /* keep UTF-8 whole */
+               ((unsigned char)app->mapping_str[off + chunk] & 0xC0) == 0x80)
+            chunk--;
+        char line[512];
+        memcpy(line, app->mapping_str + off, chunk);
+        line[chunk] = '\0';
+        draw_text(fb, 60, y, line, COL_TEXT_DIM, 1);
+        y += 16;
+        off += chunk;
+    }
+    (void)cx;
+}
+
+/* ================================================================
+ * State: directory browser
+ * ================================================================ */
+
+/* Save the mapping as <GUID>.txt in dir. The write runs in the
+ * background; the review screen shows progress. */
+static void start_save(App *app, const char *dir)
+{
+    Controller *c = &app->controllers[app->sel_ctrl];
+    char filepath[MAX_PATH_LEN];
+
+    review_model_update(app);
+    build_save_path(dir, c->guid, filepath, sizeof(filepath));
+    if (!app->saveq.running) {
+        /* no worker thread could be started */
+        save_finished(app, filepath,
+                      save_mapping_file(filepath, app->mapping_str) == 0
+                      ? 0 : errno);
+    } else if (save_queue_submit(&app->saveq, filepath, app->mapping_str) == 0) {
+        app->save_pending++;
+    } else if (!app->save_retry.path[0]) {
+        /* queue full: hold it and resubmit from poll_save_results(),
+         * never write on the main loop while the stick is slow */
+        snprintf(app->save_retry.path, sizeof(app->save_retry.path), "%s",
+                 filepath);
+        snprintf(app->save_retry.data, sizeof(app->save_retry.data), "%s",
+                 app->mapping_str);
+        app->save_pending++;
+    } else {
+        save_finished(app, filepath, EBUSY);
+    }
+}
+
+static void update_browse(App *app)
+{
+    int dy, dx, btn_a, btn_b, btn_start;
+    int key;
+    int got_ctrl = read_nav_input(app, &dy, &dx, &btn_a, &btn_b, &btn_start,
+                                  &key);
+    (void)dx;
+
+    /* read the next page of the listing only once the selection is
+     * within a screen of the rows loaded so far */
+    if (app->browser.selected + BROWSER_VISIBLE >= app->browser.count)
+        browser_load_page(&app->browser);
+
+    /* Keyboard input */
+    if (key == KEY_UP)    dy = -1;
+    if (key == KEY_DOWN)  dy = 1;
+    if (key == KEY_ENTER) btn_a = 1;
+    if (key == KEY_LEFT || key == KEY_BACKSPACE) btn_b = 1;
+    if (key == KEY_Q || key == KEY_ESC) btn_start = 1;
+
+    if (!got_ctrl && !key)
+        return;
+
+    DirBrowser *b = &app->browser;
+
+    if (dy) {
+        b->selected += dy;
+        if (b->selected < 0) b->selected = 0;
+        if (b->selected >= b->count) b->selected = b->count - 1;
+        /* scroll */
+        if (b->selected < b->scroll) b->scroll = b->selected;
+        if (b->selected >= b->scroll + BROWSER_VISIBLE)
+            b->scroll = b->selected - BROWSER_VISIBLE + 1;
+    }
+    if (btn_a && b->count > 0) {
+        char newpath[MAX_PATH_LEN];
+        if (browser_row_path(b, b->selected, newpath, sizeof(newpath)) == 0) {
+            /* ".." or a subdirectory */
+            browser_load(b, newpath);
+        } else {
+            /* save to current directory */
+            start_save(app, b->path);
+            app->state = STATE_REVIEW;
+            drain_nav_events(app);
+        }
+    }
+    if (btn_b) {
+        /* go up */
+        char *slash = strrchr(app->browser.path, '/');
+        if (slash && slash != app->browser.path) {
+            *slash = '\0';
+        } else {
+            strcpy(app->browser.path, "/");
+        }
+        browser_load(&app->browser, app->browser.path);
+    }
+    if (btn_start) {
+        /* same button that entered the save menu quits it */
+        app->state = STATE_REVIEW;
+        return;
+    }
+    if (dy || btn_a || btn_b)
+        browser_prefetch_selected(b);
+}
+
+static void render_browse(App *app)
+{
+    Framebuffer *fb = &app->fb;
+    DirBrowser *b = &app->browser;
+    char buf[512];
+
+    /* Header */
+    draw_rect(fb, 0, 0, fb->width, 36, COL_HEADER_BG);
+    draw_text(fb, 16, 10, "Select Export Directory", COL_TEXT_TITLE, 1);
+
+    int y = 50;
+    snprintf(buf, sizeof(buf), "Current: %.480s/%s", b->path,
+             b->dir ? "  (more below)" : "");
+    draw_text(fb, 60, y, buf, COL_TEXT, 1);
+
+    y += 30;
+    draw_rect(fb, 50, y, fb->width - 100, 1, COL_BORDER);
+    y += 8;
+
+    for (int i = b->scroll; i < b->count && i < b->scroll + BROWSER_VISIBLE; i++) {
+        int hl = (i == b->selected);
+        int is_dir;
+        const char *name = browser_row(b, i, &is_dir);
+        if (hl)
+            draw_rect(fb, 50, y - 2, fb->width - 100, 22, COL_SELECTED);
+
+        if (is_dir) {
+            snprintf(buf, sizeof(buf), "[%.500s]", name);
+            draw_text(fb, 70, y, buf, hl ? COL_TEXT_TITLE : COL_TEXT, 1);
+        } else {
+            /* export action entry */
+            draw_text(fb, 70, y, name, hl ? COL_TEXT_TITLE : COL_SUCCESS, 1);
+        }
+        y += 24;
+    }
+
+    /* Help */
+    int hy = fb->height - 80;
+    draw_rect(fb, 50, hy, fb->width - 100, 1, COL_BORDER);
+    hy += 12;
+    draw_text(fb, 60, hy,
+              "Controller: Up/Down=Navigate  LFire/A=Select  "
+              "B=Go up  Start=Quit",
+              COL_TEXT_DIM, 1);
+    hy += 16;
+    draw_text(fb, 60, hy,
+              "Keyboard: Arrows=Navigate  Enter=Select  "
+              "Left/Bksp=Go up  Q/Esc=Quit",
+              COL_TEXT_DIM, 1);
+
+    hy += 20;
+    snprintf(buf, sizeof(buf), "File will be saved as: %.450s/%.32s.txt",
+             b->path, app->controllers[app->sel_ctrl].guid);
+    draw_text(fb, 60, hy, buf, COL_TEXT_DIM, 1);
+}
+
+/* ================================================================
+ * State: done
+ * ================================================================ */
+
+static void update_done(App *app)
+{
+    Controller *c = &app->controllers[app->sel_ctrl];
+    struct input_event ev;
+    while (read(c->fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
+        if (ev.type == EV_KEY && ev.value == 1) {
+            app->state = STATE_EXIT;
+            return;
+        }
+    }
+    /* Also accept THEJOYSTICK button press to exit */
+    if (app->thec64_nav_idx >= 0) {
+        Controller *t = &app->controllers[app->thec64_nav_idx];
+        while (read(t->fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
+            if (ev.type == EV_KEY && ev.value == 1) {
+                app->state = STATE_EXIT;
+                return;
+            }
+        }
+    }
+}
+
+static void render_done(App *app)
+{
+    Framebuffer *fb = &app->fb;
+    int cx = fb->width / 2;
+    int y = 80;
 
-    /* Vertical navigation */
-    if (dy) {
-        app->review_sel += dy;
-        if (app->review_sel < 0) app->review_sel = 0;
-        if (app->review_sel >= REVIEW_TOTAL_ITEMS)
-            app->review_sel = REVIEW_TOTAL_ITEMS - 1;
+    draw_text_centered(fb, cx, y, "Mapping Saved!", COL_SUCCESS, 3);
+
+    y += 80;
+    char buf[512];
+    snprintf(buf, sizeof(buf), "File: %.500s", app->save_path);
+    draw_text_centered(fb, cx, y, buf, COL_TEXT, 1);
+
+    y += 40;
+    draw_text(fb, 60, y, "Contents:", COL_TEXT_DIM, 1);
+    y += 24;
+
+    /* wrap mapping string */
+    int mlen = strlen(app->mapping_str);
+    int chars_per_line = (fb->width - 120) / (FONT_W * 1);
+    int off = 0;
+    while (off < mlen) {
+        int chunk = mlen - off;
+        if (chunk > chars_per_line) chunk = chars_per_line;
+        while (chunk > 1 && off + chunk < mlen &&  /* keep UTF-8 whole */
+               ((unsigned char)app->mapping_str[off + chunk] & 0xC0) == 0x80)
+            chunk--;
+        char line[512];
+        memcpy(line, app->mapping_str + off, chunk);
+        line[chunk] = '\0';
+        draw_text(fb, 60, y, line, COL_TEXT, 1);
+        y += 18;
+        off += chunk;
     }
 
-    /* Right on a mapping row (0..9) = redo that mapping */
-    if (dx > 0 && app->review_sel >= 0 && app->review_sel < NUM_MAPPINGS) {
-        review_redo_selected(app);
-        return;
+    y += 30;
+    draw_text_centered(fb, cx, y, "Press any button to exit", COL_TEXT_DIM, 2);
+}
+
+/* ================================================================
+ * Control socket
+ *
+ * A Unix stream socket for station scripts, serviced once per frame
+ * from the main loop and never blocking it. Requests are text lines,
+ * each answered by one "OK ..." or "ERR ..." line; "list" follows its
+ * OK line with one line per controller. Requests may be pipelined.
+ *
+ *   state                 OK <state> ctrl=<i|-> prompt=<name|-> mapped=<n>
+ *                            save=<none|pending|ok|error> [path=<file>]
+ *   list                  OK <n>, then "<i> <guid> <path> <name>" lines
+ *   select <i>            map controller i (detect screen)
+ *   capture <value>       answer the current prompt (b3, a1, h0.4)
+ *   set <name> <value>    change one mapping on the review screen
+ *   save [dir]            save <GUID>.txt to dir (default /mnt)
+ *   mapping               OK <mapping string>
+ *   another               finish this controller, back to detect
+ *   quit                  exit
+ * ================================================================ */
+
+static int ctl_open(Control *ctl, const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    for (int i = 0; i < CTL_MAX_CLIENTS; i++)
+        ctl->clients[i].fd = -1;
+    ctl->listen_fd = -1;
+    if (!path) return 0;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: control socket path too long\n", path);
+        return -1;
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);  /* stale socket from an earlier run */
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, CTL_MAX_CLIENTS) < 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return -1;
     }
+    ctl->listen_fd = fd;
+    snprintf(ctl->path, sizeof(ctl->path), "%s", path);
+    return 0;
+}
 
-    /* Confirm on action rows or mapping rows */
-    if (btn_a || key == KEY_ENTER || key == KEY_SPACE) {
-        if (app->review_sel >= 0 && app->review_sel < NUM_MAPPINGS) {
-            /* selecting a mapping row = redo it */
-            review_redo_selected(app);
+static void ctl_drop(CtlClient *cl)
+{
+    close(cl->fd);
+    cl->fd = -1;
+    free(cl->out);
+    cl->out = NULL;
+    cl->out_len = cl->out_cap = 0;
+}
+
+static void ctl_close(Control *ctl)
+{
+    if (ctl->listen_fd < 0) return;
+    for (int i = 0; i < CTL_MAX_CLIENTS; i++)
+        if (ctl->clients[i].fd >= 0)
+            ctl_drop(&ctl->clients[i]);
+    close(ctl->listen_fd);
+    ctl->listen_fd = -1;
+    unlink(ctl->path);
+}
+
+/* Queue a response. The buffer grows to hold a whole response, e.g. a
+ * "list" of many pads; ctl_poll() bounds the backlog by not running
+ * more requests from a client until it has read what is queued. */
+static void ctl_printf(CtlClient *cl, const char *fmt, ...)
+{
+    va_list ap;
+
+    while (!cl->overflow) {
+        size_t room = cl->out_cap - cl->out_len;
+        va_start(ap, fmt);
+        int n = vsnprintf(cl->out ? cl->out + cl->out_len : NULL, room,
+                          fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            cl->overflow = 1;
+        } else if ((size_t)n < room) {
+            cl->out_len += n;
             return;
+        } else {
+            size_t cap = cl->out_cap ? cl->out_cap : CTL_LINE_MAX;
+            while (cap <= cl->out_len + n) cap *= 2;
+            char *out = realloc(cl->out, cap);
+            if (!out) cl->overflow = 1;
+            else { cl->out = out; cl->out_cap = cap; }
         }
-        if (app->review_sel == REVIEW_ACTION_SAVE) {
-            review_save(app);
-            return;
+    }
+}
+
+/* Send what the socket takes now. Returns -1 if the client is gone. */
+static int ctl_flush(CtlClient *cl)
+{
+    size_t sent = 0;
+    while (sent < cl->out_len) {
+        ssize_t n = send(cl->fd, cl->out + sent, cl->out_len - sent,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
         }
-        if (app->review_sel == REVIEW_ACTION_RESTART) {
-            review_restart(app);
-            return;
+        sent += n;
+    }
+    memmove(cl->out, cl->out + sent, cl->out_len - sent);
+    cl->out_len -= sent;
+    return 0;
+}
+
+static const char *state_name(AppState s)
+{
+    switch (s) {
+    case STATE_DETECT:  return "detect";
+    case STATE_MAPPING: return "mapping";
+    case STATE_REVIEW:  return "review";
+    case STATE_BROWSE:  return "browse";
+    case STATE_TEST:    return "test";
+    case STATE_DONE:    return "done";
+    default:            return "exit";
+    }
+}
+
+static void ctl_command(App *app, CtlClient *cl, char *line)
+{
+    char *cmd = strtok(line, " \t\r");
+    char *arg1 = strtok(NULL, " \t\r");
+    char *arg2 = strtok(NULL, " \t\r");
+    char val[32];
+
+    if (!cmd) return;
+
+    if (strcmp(cmd, "state") == 0) {
+        int mapped = 0;
+        for (int i = 0; i < NUM_MAPPINGS; i++)
+            mapped += app->mappings[i].mapped_type != MAP_NONE;
+        const char *save = app->save_pending ? "pending" :
+                           !app->save_path[0] ? "none" :
+                           app->save_err ? "error" : "ok";
+        ctl_printf(cl, "OK %s ctrl=", state_name(app->state));
+        if (app->sel_ctrl >= 0) ctl_printf(cl, "%d", app->sel_ctrl);
+        else ctl_printf(cl, "-");
+        ctl_printf(cl, " prompt=%s mapped=%d save=%s",
+                   app->state == STATE_MAPPING ?
+                   app->mappings[app->cur_map].gcdb_name : "-",
+                   mapped, save);
+        if (app->save_path[0] && !app->save_pending)
+            ctl_printf(cl, " path=%s", app->save_path);
+        ctl_printf(cl, "\n");
+    } else if (strcmp(cmd, "list") == 0) {
+        ctl_printf(cl, "OK %d\n", app->num_controllers);
+        for (int i = 0; i < app->num_controllers; i++)
+            ctl_printf(cl, "%d %s %s %s\n", i, app->controllers[i].guid,
+                       app->controllers[i].path, app->controllers[i].name);
+    } else if (strcmp(cmd, "select") == 0) {
+        char *end = NULL;
+        long i = arg1 ? strtol(arg1, &end, 10) : -1;
+        if (app->state != STATE_DETECT)
+            ctl_printf(cl, "ERR not on the detect screen\n");
+        else if (!arg1 || end == arg1 || *end || i < 0 ||
+                 i >= app->num_controllers)
+            ctl_printf(cl, "ERR no such controller\n");
+        else {
+            detect_select(app, i);
+            ctl_printf(cl, "OK %s\n", app->controllers[i].guid);
         }
-        if (app->review_sel == REVIEW_ACTION_ANOTHER) {
-            init_mappings(app->mappings);
-            app->sel_ctrl = -1;
-            app->thec64_nav_idx = -1;
-            app->state = STATE_DETECT;
-            app->save_path[0] = '\0';
-            return;
+    } else if (strcmp(cmd, "capture") == 0) {
+        MappingEntry *m = &app->mappings[app->cur_map];
+        if (app->state != STATE_MAPPING)
+            ctl_printf(cl, "ERR not mapping\n");
+        else if (!arg1 || parse_mapping_value(arg1, m) < 0)
+            ctl_printf(cl, "ERR bad value\n");
+        else {
+            format_mapping_value(m, val, sizeof(val));
+            ctl_printf(cl, "OK %s:%s\n", m->gcdb_name, val);
+            mapping_advance(app);
         }
-        if (app->review_sel == REVIEW_ACTION_QUIT) {
-            app->state = STATE_EXIT;
-            return;
+    } else if (strcmp(cmd, "set") == 0) {
+        int idx = arg1 ? find_mapping(app->mappings, arg1) : -1;
+        if (app->state != STATE_REVIEW)
+            ctl_printf(cl, "ERR not on the review screen\n");
+        else if (idx < 0)
+            ctl_printf(cl, "ERR unknown input\n");
+        else if (!arg2 || parse_mapping_value(arg2, &app->mappings[idx]) < 0)
+            ctl_printf(cl, "ERR bad value\n");
+        else {
+            mappings_changed(app);
+            ctl_printf(cl, "OK\n");
         }
+    } else if (strcmp(cmd, "save") == 0) {
+        if (app->state != STATE_REVIEW)
+            ctl_printf(cl, "ERR not on the review screen\n");
+        else {
+            start_save(app, arg1 ? arg1 : "/mnt");
+            ctl_printf(cl, "OK\n");
+        }
+    } else if (strcmp(cmd, "mapping") == 0) {
+        if (app->sel_ctrl < 0)
+            ctl_printf(cl, "ERR no controller selected\n");
+        else {
+            review_model_update(app);
+            ctl_printf(cl, "OK %s\n", app->mapping_str);
+        }
+    } else if (strcmp(cmd, "another") == 0) {
+        if (app->state != STATE_REVIEW)
+            ctl_printf(cl, "ERR not on the review screen\n");
+        else {
+            review_another(app);
+            ctl_printf(cl, "OK\n");
+        }
+    } else if (strcmp(cmd, "quit") == 0) {
+        app->state = STATE_EXIT;
+        ctl_printf(cl, "OK\n");
+    } else {
+        ctl_printf(cl, "ERR unknown command\n");
     }
+}
 
-    /* Shortcut buttons still work regardless of cursor position */
-    if (btn_b) {
-        if (app->review_sel >= 0 && app->review_sel < NUM_MAPPINGS) {
-            review_redo_selected(app);
-            return;
+/* Accept clients, run complete request lines and send responses. At
+ * most CTL_CMDS_PER_FRAME requests run per frame so a busy script
+ * cannot stall rendering. */
+static void ctl_poll(App *app)
+{
+    Control *ctl = &app->ctl;
+    int budget = CTL_CMDS_PER_FRAME;
+
+    if (ctl->listen_fd < 0) return;
+
+    for (;;) {
+        int fd = accept4(ctl->listen_fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) break;
+        int i = 0;
+        while (i < CTL_MAX_CLIENTS && ctl->clients[i].fd >= 0) i++;
+        if (i == CTL_MAX_CLIENTS) {
+            static const char busy[] = "ERR too many clients\n";
+            send(fd, busy, sizeof(busy) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+            close(fd);
+            continue;
         }
+        CtlClient *cl = &ctl->clients[i];
+        cl->fd = fd;
+        cl->in_len = cl->out_len = 0;
+        cl->overflow = 0;
     }
-    if (btn_start) {
-        review_save(app);
-        return;
+
+    for (int i = 0; i < CTL_MAX_CLIENTS; i++) {
+        CtlClient *cl = &ctl->clients[i];
+        if (cl->fd < 0) continue;
+
+        int gone = 0;
+        if (cl->in_len < sizeof(cl->in)) {
+            ssize_t n = recv(cl->fd, cl->in + cl->in_len,
+                             sizeof(cl->in) - cl->in_len, MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+                gone = 1;
+            else if (n > 0)
+                cl->in_len += n;
+        }
+
+        /* run complete lines; the rest waits for more input, budget or
+         * the client reading its backlog */
+        size_t start = 0;
+        char *nl;
+        while (budget > 0 && app->state != STATE_EXIT &&
+               cl->out_len < CTL_OUT_MAX &&
+               (nl = memchr(cl->in + start, '\n', cl->in_len - start))) {
+            *nl = '\0';
+            ctl_command(app, cl, cl->in + start);
+            start = nl + 1 - cl->in;
+            budget--;
+        }
+        memmove(cl->in, cl->in + start, cl->in_len - start);
+        cl->in_len -= start;
+        if (cl->in_len == sizeof(cl->in) &&
+            !memchr(cl->in, '\n', cl->in_len)) {
+            ctl_printf(cl, "ERR line too long\n");
+            cl->in_len = 0;
+        }
+
+        if (cl->overflow || ctl_flush(cl) < 0 || (gone && cl->out_len == 0))
+            ctl_drop(cl);
     }
 }
 
-static void render_review(App *app)
+/* ================================================================
+ * Headless CLI mode
+ *
+ * Runs the same capture logic as the GUI without touching the
+ * framebuffer. A script file, when given, lists one mapping per line:
+ *
+ *   lefttrigger          capture from the device (prompt on stdout)
+ *   righttrigger b1      assign directly without capturing
+ *   # comment
+ *
+ * A batch list holds one session per line: DEVICE [OUTPUT [SCRIPT]].
+ * OUTPUT is a file, a directory (receives <GUID>.txt) or "-" for stdout.
+ * ================================================================ */
+
+/* Block until the prompt for mapping idx is answered on the device */
+static int cli_capture(App *app, int idx)
 {
-    Framebuffer *fb = &app->fb;
-    int cx = fb->width / 2;
-    char buf[256];
+    Controller *c = &app->controllers[app->sel_ctrl];
+    MappingEntry *m = &app->mappings[idx];
+    struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+    char val[32];
 
-    /* Header */
-    draw_rect(fb, 0, 0, fb->width, 36, COL_HEADER_BG);
-    draw_text(fb, 16, 10, "Review Mappings", COL_TEXT_TITLE, 1);
+    printf("[%d/%d] %s (%s): ", idx + 1, NUM_MAPPINGS, m->prompt,
+           m->gcdb_name);
+    fflush(stdout);
 
-    int y = 50;
+    while (!g_quit) {
+        if (poll(&pfd, 1, 250) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (pfd.revents & (POLLERR | POLLHUP)) {
+            fprintf(stderr, "\n%s: device disconnected\n", c->path);
+            return -1;
+        }
+        if (!poll_mapping_input(app, m))
+            continue;
+
+        drain_events(app, c);
+        usleep(DEBOUNCE_MS * 1000);
+        drain_events(app, c);
+
+        format_mapping_value(m, val, sizeof(val));
+        printf("%s\n", val);
+        return 0;
+    }
+    printf("\n");
+    return -1;
+}
+
+static int cli_run_script(App *app, const char *script)
+{
+    char line[256], name[64], value[64];
+    int lineno = 0, rc = 0;
+
+    FILE *sf = fopen(script, "r");
+    if (!sf) {
+        perror(script);
+        return -1;
+    }
 
-    /* Check for duplicate assignments */
-    int has_dupes = 0;
-    for (int i = 0; i < NUM_MAPPINGS && !has_dupes; i++) {
-        if (app->mappings[i].mapped_type == MAP_NONE) continue;
-        for (int j = i + 1; j < NUM_MAPPINGS; j++) {
-            if (app->mappings[j].mapped_type == app->mappings[i].mapped_type &&
-                app->mappings[j].mapped_index == app->mappings[i].mapped_index &&
-                (app->mappings[i].mapped_type != MAP_HAT ||
-                 app->mappings[j].hat_mask == app->mappings[i].hat_mask)) {
-                has_dupes = 1;
-                break;
+    while (rc == 0 && fgets(line, sizeof(line), sf)) {
+        lineno++;
+        int n = sscanf(line, " %63s %63s", name, value);
+        if (n < 1 || name[0] == '#') continue;
+
+        int idx = find_mapping(app->mappings, name);
+        if (idx < 0) {
+            fprintf(stderr, "%s:%d: unknown input '%s'\n", script, lineno, name);
+            rc = -1;
+        } else if (n == 2 && value[0] != '#') {
+            if (parse_mapping_value(value, &app->mappings[idx]) < 0) {
+                fprintf(stderr, "%s:%d: bad value '%s'\n", script, lineno, value);
+                rc = -1;
+            } else {
+                printf("[%d/%d] %s: %s\n", idx + 1, NUM_MAPPINGS, name, value);
             }
+        } else {
+            rc = cli_capture(app, idx);
         }
     }
+    fclose(sf);
+    return rc;
+}
 
-    /* Column headers */
-    draw_text(fb, 60, y, "THE64 Input", COL_TEXT_DIM, 1);
-    draw_text(fb, 260, y, "Mapped To", COL_TEXT_DIM, 1);
-    draw_text(fb, 460, y, "gamecontrollerdb", COL_TEXT_DIM, 1);
-    if (has_dupes)
-        draw_text(fb, 660, y, "Duplicate Assignment", COL_TEXT_DIM, 1);
+static int cli_write_output(App *app, const char *output)
+{
+    Controller *c = &app->controllers[app->sel_ctrl];
+    char filepath[MAX_PATH_LEN];
+    struct stat st;
 
-    y += 24;
-    draw_rect(fb, 50, y, fb->width - 100, 1, COL_BORDER);
-    y += 8;
+    if (!output || strcmp(output, "-") == 0) {
+        printf("%s\n", app->mapping_str);
+        return 0;
+    }
 
-    for (int i = 0; i < NUM_MAPPINGS; i++) {
-        MappingEntry *m = &app->mappings[i];
-        int hl = (i == app->review_sel);
+    if (stat(output, &st) == 0 && S_ISDIR(st.st_mode))
+        build_save_path(output, c->guid, filepath, sizeof(filepath));
+    else
+        snprintf(filepath, sizeof(filepath), "%s", output);
 
-        if (hl)
-            draw_rect(fb, 50, y - 2, fb->width - 100, 22, COL_SELECTED);
+    if (save_mapping_file(filepath, app->mapping_str) < 0) {
+        perror(filepath);
+        return -1;
+    }
+    printf("Saved to: %s\n", filepath);
+    return 0;
+}
 
-        draw_text(fb, 60, y, m->the64_label, hl ? COL_TEXT_TITLE : COL_TEXT, 1);
+static int cli_run_session(App *app, const char *device, const char *output,
+                           const char *script)
+{
+    int rc;
 
-        switch (m->mapped_type) {
-        case MAP_BUTTON:
-            snprintf(buf, sizeof(buf), "Button %d", m->mapped_index);
-            break;
-        case MAP_AXIS:
-            snprintf(buf, sizeof(buf), "Axis %d", m->mapped_index);
-            break;
-        case MAP_HAT:
-            snprintf(buf, sizeof(buf), "Hat %d.%d", m->mapped_index,
-                     m->hat_mask);
-            break;
-        default:
-            snprintf(buf, sizeof(buf), "(none)");
-            break;
-        }
-        draw_text(fb, 260, y, buf, hl ? COL_TEXT_TITLE : COL_TEXT, 1);
+    if (ctrl_reserve(app, 1) < 0 ||
+        open_controller(&app->controllers[0], device) < 0) {
+        fprintf(stderr, "%s: cannot open or not a game controller\n", device);
+        return -1;
+    }
+    probe_controller(&app->controllers[0]);
+    app->num_controllers = 1;
+    app->sel_ctrl = 0;
+    app->thec64_nav_idx = -1;
+    init_mappings(app->mappings);
 
-        snprintf(buf, sizeof(buf), "%s:", m->gcdb_name);
-        switch (m->mapped_type) {
-        case MAP_BUTTON:
-            snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
-                     "b%d", m->mapped_index);
-            break;
-        case MAP_AXIS:
-            snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
-                     "a%d", m->mapped_index);
-            break;
-        case MAP_HAT:
-            snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
-                     "h%d.%d", m->mapped_index, m->hat_mask);
-            break;
-        default:
-            break;
-        }
-        draw_text(fb, 460, y, buf, COL_MAPPED, 1);
+    printf("Controller: %s\nGUID: %s\n", app->controllers[0].name,
+           app->controllers[0].guid);
+    drain_events(app, &app->controllers[0]);
 
-        /* Show duplicate assignments for this row */
-        if (has_dupes && m->mapped_type != MAP_NONE) {
-            char dups[256] = "";
-            for (int j = 0; j < NUM_MAPPINGS; j++) {
-                if (j == i) continue;
-                if (app->mappings[j].mapped_type == m->mapped_type &&
-                    app->mappings[j].mapped_index == m->mapped_index &&
-                    (m->mapped_type != MAP_HAT ||
-                     app->mappings[j].hat_mask == m->hat_mask)) {
-                    if (dups[0] != '\0')
-                        strncat(dups, ", ", sizeof(dups) - strlen(dups) - 1);
-                    strncat(dups, app->mappings[j].the64_label,
-                            sizeof(dups) - strlen(dups) - 1);
-                }
-            }
-            if (dups[0] != '\0')
-                draw_text(fb, 660, y, dups, COL_ERROR, 1);
-        }
+    if (script) {
+        rc = cli_run_script(app, script);
+    } else {
+        rc = 0;
+        for (int i = 0; i < NUM_MAPPINGS && rc == 0; i++)
+            rc = cli_capture(app, i);
+    }
 
-        y += 24;
+    if (rc == 0) {
+        build_mapping_string(app, app->mapping_str, sizeof(app->mapping_str));
+        rc = cli_write_output(app, output);
     }
 
-    /* Action buttons */
-    y += 12;
-    draw_rect(fb, 50, y, fb->width - 100, 1, COL_BORDER);
-    y += 10;
+    close_controllers(app);
+    return rc;
+}
 
-    {
-        struct { int idx; const char *label; const char *key; uint32_t col; } actions[] = {
-            { REVIEW_ACTION_SAVE,    "Save to File",          "2", COL_SUCCESS },
-            { REVIEW_ACTION_RESTART, "Start Over",            "3", COL_HIGHLIGHT },
-            { REVIEW_ACTION_ANOTHER, "Map Another Controller","4", COL_TEXT },
-            { REVIEW_ACTION_QUIT,    "Quit",                  "Q", COL_ERROR },
-        };
-        for (int i = 0; i < 4; i++) {
-            int hl = (app->review_sel == actions[i].idx);
-            if (hl)
-                draw_rect(fb, 50, y - 2, fb->width - 100, 22, COL_SELECTED);
-            snprintf(buf, sizeof(buf), "[%s] %s", actions[i].key, actions[i].label);
-            draw_text(fb, 70, y, buf,
-                      hl ? COL_TEXT_TITLE : actions[i].col, 1);
-            y += 24;
-        }
+static int cli_run_batch(App *app, const char *list)
+{
+    char line[3 * MAX_PATH_LEN];
+    char device[MAX_PATH_LEN], output[MAX_PATH_LEN], script[MAX_PATH_LEN];
+    int sessions = 0, saved = 0;
+
+    FILE *lf = fopen(list, "r");
+    if (!lf) {
+        perror(list);
+        return -1;
     }
 
-    /* Help */
-    y += 6;
-    draw_rect(fb, 50, y, fb->width - 100, 1, COL_BORDER);
-    y += 8;
-    draw_text(fb, 60, y,
-              "Keyboard: Arrows=Navigate  Right/Enter=Redo  1=Redo sel  "
-              "2=Save  3=Restart  4=Another  Q=Quit",
-              COL_TEXT_DIM, 1);
-    y += 16;
-    draw_text(fb, 60, y,
-              "Controller: Stick=Navigate  Right=Redo  LFire/A=Confirm  "
-              "B=Redo  Start=Save",
-              COL_TEXT_DIM, 1);
+    while (!g_quit && fgets(line, sizeof(line), lf)) {
+        int n = sscanf(line, " %511s %511s %511s", device, output, script);
+        if (n < 1 || device[0] == '#') continue;
+
+        sessions++;
+        printf("=== Session %d: %s ===\n", sessions, device);
+        if (cli_run_session(app, device, n >= 2 ? output : NULL,
+                            n >= 3 ? script : NULL) == 0)
+            saved++;
+    }
+    fclose(lf);
+
+    printf("Batch: %d/%d sessions saved\n", saved, sessions);
+    return saved == sessions ? 0 : -1;
+}
+
+/* ================================================================
+ * Launcher (replaces the killall loop in start.sh)
+ * ================================================================ */
+
+/* Collect pids whose comm is "the64" */
+static int find_the64(pid_t *pids, int max)
+{
+    DIR *dir;
+    struct dirent *entry;
+    char path[64], comm[32];
+    int n = 0;
+
+    dir = opendir("/proc");
+    if (!dir) return 0;
+
+    while (n < max && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] < '1' || entry->d_name[0] > '9') continue;
+        pid_t pid = (pid_t)atoi(entry->d_name);
+        if (pid == getpid()) continue;
+
+        snprintf(path, sizeof(path), "/proc/%d/comm", (int)pid);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) continue;
+        ssize_t len = read(fd, comm, sizeof(comm) - 1);
+        close(fd);
+        if (len <= 0) continue;
+        comm[len] = '\0';
+        comm[strcspn(comm, "\n")] = '\0';
+
+        if (strcmp(comm, "the64") == 0)
+            pids[n++] = pid;
+    }
+    closedir(dir);
+    return n;
+}
+
+/* A process counts as gone once it is a zombie; we are not its parent */
+static int proc_alive(pid_t pid)
+{
+    char path[64], buf[256];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+
+    /* "pid (comm) S ..." - the state follows the last ')' */
+    char *p = strrchr(buf, ')');
+    return p && p[1] == ' ' && p[2] != 'Z' && p[2] != 'X';
+}
 
-    /* Saved confirmation */
-    if (app->save_path[0] != '\0') {
-        y += 16;
-        snprintf(buf, sizeof(buf), "Saved to: %.200s", app->save_path);
-        draw_text(fb, 60, y, buf, COL_SUCCESS, 1);
+/* Wait up to timeout_ms for pid to exit. Returns 0 once it has. */
+static int wait_exit(pid_t pid, int timeout_ms)
+{
+    uint64_t end = time_ms() + timeout_ms;
+
+#ifdef SYS_pidfd_open
+    int pfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (pfd >= 0) {
+        struct pollfd p = { .fd = pfd, .events = POLLIN };
+        int r;
+        for (;;) {
+            uint64_t now = time_ms();
+            int left = now < end ? (int)(end - now) : 0;
+            r = poll(&p, 1, left);
+            if (r >= 0 || errno != EINTR) break;
+        }
+        close(pfd);
+        return r > 0 ? 0 : -1;
     }
+    if (errno == ESRCH) return 0;
+#endif
 
-    /* GUID and full string */
-    y += 24;
-    snprintf(buf, sizeof(buf), "GUID: %s",
-             app->controllers[app->sel_ctrl].guid);
-    draw_text(fb, 60, y, buf, COL_TEXT, 1);
+    /* kernels without pidfd: poll /proc */
+    while (proc_alive(pid)) {
+        if (time_ms() >= end) return -1;
+        usleep(5000);
+    }
+    return 0;
+}
 
-    y += 24;
-    /* wrap mapping string display */
-    build_mapping_string(app, app->mapping_str, sizeof(app->mapping_str));
-    int mlen = strlen(app->mapping_str);
-    int chars_per_line = (fb->width - 120) / (FONT_W * 1);
-    int off = 0;
-    while (off < mlen) {
-        int chunk = mlen - off;
-        if (chunk > chars_per_line) chunk = chars_per_line;
-        char line[512];
-        memcpy(line, app->mapping_str + off, chunk);
-        line[chunk] = '\0';
-        draw_text(fb, 60, y, line, COL_TEXT_DIM, 1);
-        y += 16;
-        off += chunk;
+/* SIGTERM every running the64, escalating to SIGKILL after a grace
+ * period. Returns the number of processes stopped. */
+static int stop_the64(void)
+{
+    pid_t pids[MAX_THE64_PIDS];
+    int n = find_the64(pids, MAX_THE64_PIDS);
+
+    for (int i = 0; i < n; i++)
+        kill(pids[i], SIGTERM);
+    for (int i = 0; i < n; i++) {
+        if (wait_exit(pids[i], THE64_TERM_MS) == 0) continue;
+        fprintf(stderr, "the64 (pid %d) ignored SIGTERM, sending SIGKILL\n",
+                (int)pids[i]);
+        kill(pids[i], SIGKILL);
+        if (wait_exit(pids[i], THE64_KILL_MS) < 0)
+            fprintf(stderr, "the64 (pid %d) did not exit\n", (int)pids[i]);
     }
-    (void)cx;
+    return n;
+}
+
+/* Start the64 detached from us, as "the64 &" did in start.sh */
+static void relaunch_the64(void)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* do not pass realtime priority or pinning on to the64 */
+        struct sched_param sp = { .sched_priority = 0 };
+        cpu_set_t all;
+        CPU_ZERO(&all);
+        for (int i = 0; i < CPU_SETSIZE; i++) CPU_SET(i, &all);
+        sched_setscheduler(0, SCHED_OTHER, &sp);
+        sched_setaffinity(0, sizeof(all), &all);
+        setsid();
+        execlp("the64", "the64", (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0)
+        perror("fork the64");
 }
 
 /* ================================================================
- * State: directory browser
+ * Watcher daemon
+ *
+ * Sleeps in read() on an inotify watch of /dev/input, so it costs no
+ * wakeups while nothing is plugged in. A new gamepad is looked up by
+ * GUID in gamecontrollerdb.txt (and among mappings already saved on
+ * the stick); only an unknown pad starts the GUI, as a child running
+ * the --launch flow. The db index is a sorted array of binary GUIDs,
+ * reloaded when the file changes.
  * ================================================================ */
 
-static void update_browse(App *app)
+#define GCDB_PATH         "/usr/share/the64/ui/data/gamecontrollerdb.txt"
+#define WATCH_MAX_NODES   1024   /* eventN numbers tracked */
+#define WATCH_SETTLE_MS    200   /* let udev finish with a new node */
+
+typedef struct {
+    uint8_t (*guids)[16];
+    size_t    count;
+    time_t    mtime;
+    off_t     size;
+} GuidIndex;
+
+static int hex_nibble(int c)
 {
-    int dy, dx, btn_a, btn_b, btn_start;
-    int got_ctrl = read_nav_input(app, &dy, &dx, &btn_a, &btn_b, &btn_start);
-    (void)dx;
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
 
-    /* Keyboard input */
-    int key = read_keyboard(app);
-    if (key == KEY_UP)    dy = -1;
-    if (key == KEY_DOWN)  dy = 1;
-    if (key == KEY_ENTER) btn_a = 1;
-    if (key == KEY_LEFT || key == KEY_BACKSPACE) btn_b = 1;
-    if (key == KEY_Q || key == KEY_ESC) btn_start = 1;
+/* 32 hex digits to 16 bytes. Returns -1 if s does not start with one. */
+static int parse_guid(const char *s, uint8_t out[16])
+{
+    for (int i = 0; i < 16; i++) {
+        int hi = hex_nibble(s[2 * i]), lo = hex_nibble(s[2 * i + 1]);
+        if (hi < 0 || lo < 0) return -1;
+        out[i] = hi << 4 | lo;
+    }
+    return 0;
+}
 
-    if (!got_ctrl && !key)
-        return;
+static int guid_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, 16);
+}
 
-    DirBrowser *b = &app->browser;
+/* (Re)build the index if the db changed since the last load */
+static void gcdb_refresh(GuidIndex *ix, const char *path)
+{
+    struct stat st;
+    char *line = NULL;
+    size_t cap = 0, n = 0, alloc = 0;
 
-    if (dy) {
-        b->selected += dy;
-        if (b->selected < 0) b->selected = 0;
-        if (b->selected >= b->count) b->selected = b->count - 1;
-        /* scroll */
-        int visible = 18;
-        if (b->selected < b->scroll) b->scroll = b->selected;
-        if (b->selected >= b->scroll + visible) b->scroll = b->selected - visible + 1;
+    if (stat(path, &st) < 0) {
+        if (ix->count) fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        free(ix->guids);
+        memset(ix, 0, sizeof(*ix));
+        return;
     }
-    if (btn_a && b->count > 0) {
-        DirEntry *e = &b->entries[b->selected];
-        if (strcmp(e->name, "..") == 0) {
-            /* go up */
-            char *slash = strrchr(b->path, '/');
-            if (slash && slash != b->path) {
-                *slash = '\0';
-            } else {
-                strcpy(b->path, "/");
-            }
-            browser_load(b, b->path);
-        } else if (e->is_dir) {
-            char newpath[MAX_PATH_LEN];
-            if (strcmp(b->path, "/") == 0)
-                snprintf(newpath, sizeof(newpath), "/%.250s", e->name);
-            else
-                snprintf(newpath, sizeof(newpath), "%.250s/%.250s",
-                         b->path, e->name);
-            browser_load(b, newpath);
-        } else if (!e->is_dir) {
-            /* save to current directory */
-            Controller *c = &app->controllers[app->sel_ctrl];
-            build_mapping_string(app, app->mapping_str, sizeof(app->mapping_str));
+    if (ix->guids && st.st_mtime == ix->mtime && st.st_size == ix->size)
+        return;
 
-            char filepath[MAX_PATH_LEN];
-            if (strcmp(b->path, "/") == 0)
-                snprintf(filepath, sizeof(filepath), "/%.32s.txt", c->guid);
-            else
-                snprintf(filepath, sizeof(filepath), "%.470s/%.32s.txt",
-                         b->path, c->guid);
-
-            FILE *fp = fopen(filepath, "w");
-            if (fp) {
-                fprintf(fp, "%s\n", app->mapping_str);
-                fclose(fp);
-                snprintf(app->save_path, sizeof(app->save_path), "%s", filepath);
-                app->state = STATE_REVIEW;
-            }
-            drain_nav_events(app);
-        }
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return;
     }
-    if (btn_b) {
-        /* go up */
-        char *slash = strrchr(app->browser.path, '/');
-        if (slash && slash != app->browser.path) {
-            *slash = '\0';
-        } else {
-            strcpy(app->browser.path, "/");
+    free(ix->guids);
+    ix->guids = NULL;
+    while (getline(&line, &cap, f) > 0) {
+        uint8_t g[16];
+        if (line[0] == '#' || parse_guid(line, g) < 0 || line[32] != ',')
+            continue;
+        if (n == alloc) {
+            alloc = alloc ? alloc * 2 : 256;
+            uint8_t (*p)[16] = realloc(ix->guids, alloc * 16);
+            if (!p) break;
+            ix->guids = p;
         }
-        browser_load(&app->browser, app->browser.path);
-    }
-    if (btn_start) {
-        /* same button that entered the save menu quits it */
-        app->state = STATE_REVIEW;
-        return;
+        memcpy(ix->guids[n++], g, 16);
     }
+    free(line);
+    fclose(f);
+    qsort(ix->guids, n, 16, guid_cmp);
+    ix->count = n;
+    ix->mtime = st.st_mtime;
+    ix->size = st.st_size;
+    fprintf(stderr, "watch: %zu mappings in %s\n", n, path);
 }
 
-static void render_browse(App *app)
+/* Known if the db has it or a mapping for it was already saved */
+static int guid_known(GuidIndex *ix, const char *db, const char *save_dir,
+                      const char *guid)
 {
-    Framebuffer *fb = &app->fb;
-    DirBrowser *b = &app->browser;
-    char buf[512];
+    uint8_t g[16];
+    char path[MAX_PATH_LEN];
 
-    /* Header */
-    draw_rect(fb, 0, 0, fb->width, 36, COL_HEADER_BG);
-    draw_text(fb, 16, 10, "Select Export Directory", COL_TEXT_TITLE, 1);
+    gcdb_refresh(ix, db);
+    if (parse_guid(guid, g) == 0 && ix->count &&
+        bsearch(g, ix->guids, ix->count, 16, guid_cmp))
+        return 1;
+    build_save_path(save_dir, guid, path, sizeof(path));
+    return access(path, F_OK) == 0;
+}
 
-    int y = 50;
-    snprintf(buf, sizeof(buf), "Current: %s/", b->path);
-    draw_text(fb, 60, y, buf, COL_TEXT, 1);
+/* Run "<self> --launch [options]" and wait for it */
+static void watch_launch(char *const *argv)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv("/proc/self/exe", argv);
+        perror("exec gamepad_map");
+        _exit(127);
+    }
+    if (pid < 0) {
+        perror("fork");
+        return;
+    }
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR && !g_quit)
+        ;
+}
 
-    y += 30;
-    draw_rect(fb, 50, y, fb->width - 100, 1, COL_BORDER);
-    y += 8;
+typedef struct {
+    GuidIndex   ix;
+    const char *db;
+    const char *save_dir;
+    uint8_t     seen[WATCH_MAX_NODES / 8];  /* eventN already checked */
+} Watch;
+
+/* eventN number of a /dev/input entry, -1 for anything else */
+static int watch_node(const char *name)
+{
+    unsigned node;
+    if (sscanf(name, "event%u", &node) != 1 || node >= WATCH_MAX_NODES)
+        return -1;
+    return (int)node;
+}
 
-    int visible = 18;
-    for (int i = b->scroll; i < b->count && i < b->scroll + visible; i++) {
-        int hl = (i == b->selected);
-        if (hl)
-            draw_rect(fb, 50, y - 2, fb->width - 100, 22, COL_SELECTED);
+static int watch_seen(const Watch *w, int node)
+{
+    return w->seen[node / 8] & (1 << node % 8);
+}
 
-        if (b->entries[i].is_dir) {
-            snprintf(buf, sizeof(buf), "[%s]", b->entries[i].name);
-            draw_text(fb, 70, y, buf, hl ? COL_TEXT_TITLE : COL_TEXT, 1);
-        } else {
-            /* export action entry */
-            draw_text(fb, 70, y, b->entries[i].name,
-                      hl ? COL_TEXT_TITLE : COL_SUCCESS, 1);
-        }
-        y += 24;
-    }
+/* Check a new node once. Returns 1 if it is a pad nobody has a mapping
+ * for. */
+static int watch_check(Watch *w, const char *name, int node)
+{
+    Controller c;
+    char path[MAX_PATH_LEN];
 
-    /* Help */
-    int hy = fb->height - 80;
-    draw_rect(fb, 50, hy, fb->width - 100, 1, COL_BORDER);
-    hy += 12;
-    draw_text(fb, 60, hy,
-              "Controller: Up/Down=Navigate  LFire/A=Select  "
-              "B=Go up  Start=Quit",
-              COL_TEXT_DIM, 1);
-    hy += 16;
-    draw_text(fb, 60, hy,
-              "Keyboard: Arrows=Navigate  Enter=Select  "
-              "Left/Bksp=Go up  Q/Esc=Quit",
-              COL_TEXT_DIM, 1);
+    /* the node may still be getting its permissions */
+    usleep(WATCH_SETTLE_MS * 1000);
+    snprintf(path, sizeof(path), "/dev/input/%.200s", name);
+    errno = 0;
+    int rc = open_controller(&c, path);
+    if (rc < 0 && (errno == EACCES || errno == EPERM))
+        return 0;  /* permissions not set yet; retried on IN_ATTRIB */
+    /* keyboards, mice and the like are not looked at again either */
+    w->seen[node / 8] |= 1 << node % 8;
+    if (rc < 0)
+        return 0;
+    close(c.fd);
 
-    hy += 20;
-    snprintf(buf, sizeof(buf), "File will be saved as: %s/%s.txt",
-             b->path, app->controllers[app->sel_ctrl].guid);
-    draw_text(fb, 60, hy, buf, COL_TEXT_DIM, 1);
+    int known = guid_known(&w->ix, w->db, w->save_dir, c.guid);
+    fprintf(stderr, "watch: %s %s (%s)%s\n", path, c.guid, c.name,
+            known ? "" : " unknown, starting mapper");
+    return !known;
 }
 
-/* ================================================================
- * State: done
- * ================================================================ */
+/* Make seen[] match the nodes that exist now; the kernel reuses the
+ * lowest free number, so a stale bit would hide the next pad. Nodes not
+ * seen before are checked, or with check_new 0 just marked (the GUI
+ * that just exited has dealt with them). Returns 1 if one is unknown. */
+static int watch_rescan(Watch *w, int check_new)
+{
+    uint8_t present[WATCH_MAX_NODES / 8] = { 0 };
+    struct dirent *entry;
+    int launch = 0;
+    DIR *dir = opendir("/dev/input");
 
-static void update_done(App *app)
+    if (!dir) return 0;
+    while ((entry = readdir(dir)) != NULL) {
+        int node = watch_node(entry->d_name);
+        if (node < 0) continue;
+        present[node / 8] |= 1 << node % 8;
+        if (watch_seen(w, node)) continue;
+        if (check_new)
+            launch |= watch_check(w, entry->d_name, node);
+        else
+            w->seen[node / 8] |= 1 << node % 8;
+    }
+    closedir(dir);
+    for (size_t i = 0; i < sizeof(w->seen); i++)
+        w->seen[i] &= present[i];
+    return launch;
+}
+
+static int watch_run(const char *db, const char *save_dir, char *const *argv)
 {
-    Controller *c = &app->controllers[app->sel_ctrl];
-    struct input_event ev;
-    while (read(c->fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
-        if (ev.type == EV_KEY && ev.value == 1) {
-            app->state = STATE_EXIT;
-            return;
-        }
+    static Watch w;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct sigaction sa = { .sa_handler = sig_handler };  /* no SA_RESTART */
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int in = inotify_init1(IN_CLOEXEC);
+    if (in < 0 || inotify_add_watch(in, "/dev/input",
+                                    IN_CREATE | IN_ATTRIB | IN_DELETE) < 0) {
+        perror("inotify /dev/input");
+        return -1;
     }
-    /* Also accept THEJOYSTICK button press to exit */
-    if (app->thec64_nav_idx >= 0) {
-        Controller *t = &app->controllers[app->thec64_nav_idx];
-        while (read(t->fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
-            if (ev.type == EV_KEY && ev.value == 1) {
-                app->state = STATE_EXIT;
-                return;
+    w.db = db;
+    w.save_dir = save_dir;
+    gcdb_refresh(&w.ix, db);
+    fprintf(stderr, "watch: waiting for controllers\n");
+
+    while (!g_quit) {
+        ssize_t len = read(in, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) continue;
+            perror("inotify read");
+            break;
+        }
+        int launch = 0;
+        for (char *p = buf; p < buf + len;
+             p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            struct inotify_event *ie = (struct inotify_event *)p;
+            if (ie->mask & IN_Q_OVERFLOW) {
+                /* events were lost: find out from the directory */
+                launch |= watch_rescan(&w, 1);
+                continue;
             }
+            int node = ie->len ? watch_node(ie->name) : -1;
+            if (node < 0)
+                continue;
+            if (ie->mask & IN_DELETE) {
+                w.seen[node / 8] &= ~(1 << node % 8);
+                continue;
+            }
+            if (!watch_seen(&w, node))
+                launch |= watch_check(&w, ie->name, node);
         }
+        if (!launch) continue;
+
+        watch_launch(argv);
+        /* drop what queued while the GUI ran, then catch up from the
+         * directory: pads plugged in meanwhile were handled by the GUI,
+         * and unplugged ones must not stay marked */
+        int fl = fcntl(in, F_GETFL);
+        fcntl(in, F_SETFL, fl | O_NONBLOCK);
+        while (read(in, buf, sizeof(buf)) > 0)
+            ;
+        fcntl(in, F_SETFL, fl);
+        watch_rescan(&w, 0);
     }
+    close(in);
+    free(w.ix.guids);
+    return 0;
 }
 
-static void render_done(App *app)
+/* Event dispatch cost with n simulated devices, pipes standing in for
+ * event nodes: the old loop that reads every device each frame against
+ * epoll readiness plus the fd_slot lookup, and that plus the timestamp
+ * merge */
+static int bench_registry(App *app, int n)
 {
-    Framebuffer *fb = &app->fb;
-    int cx = fb->width / 2;
-    int y = 80;
-
-    draw_text_centered(fb, cx, y, "Mapping Saved!", COL_SUCCESS, 3);
+    const int frames = 20000, per_frame = 4;
+    struct input_event ev = { .type = EV_KEY, .code = BTN_SOUTH, .value = 1 };
+    int (*pipes)[2] = calloc(n, sizeof(*pipes));
+
+    if (!pipes || registry_init(app) < 0) return -1;
+    for (int i = 0; i < n; i++) {
+        if (pipe2(pipes[i], O_NONBLOCK | O_CLOEXEC) < 0 ||
+            ctrl_reserve(app, i + 1) < 0) {
+            perror("bench setup");
+            return -1;
+        }
+        Controller *c = &app->controllers[i];
+        memset(c, 0, sizeof(*c));
+        c->fd = pipes[i][0];
+        snprintf(c->path, sizeof(c->path), "sim%d", i);
+        if (ctrl_register(app, i) < 0) {
+            perror("bench setup");
+            return -1;
+        }
+        app->num_controllers++;
+    }
+    printf("%d simulated devices (registry capacity %d), %d frames, "
+           "%d events/frame\n", n, app->cap_controllers, frames, per_frame);
+
+    static const char *const names[] = {
+        "read every device", "epoll + fd lookup", "epoll + merge"
+    };
+    srand(1);
+    for (int mode = 0; mode < 3; mode++) {
+        uint64_t events = 0, reads = 0, us = 0;
+        for (int f = 0; f < frames; f++) {
+            for (int k = 0; k < per_frame; k++) {
+                /* increasing per device, as the kernel stamps them */
+                uint64_t t = (uint64_t)f * FRAME_MS * 1000 + k * 1000 +
+                             rand() % 1000;
+#ifdef input_event_sec
+                ev.input_event_sec = t / 1000000;
+                ev.input_event_usec = t % 1000000;
+#else
+                ev.time.tv_sec = t / 1000000;
+                ev.time.tv_usec = t % 1000000;
+#endif
+                if (write(pipes[rand() % n][1], &ev, sizeof(ev)) < 0)
+                    perror("bench write");
+            }
 
-    y += 80;
-    char buf[512];
-    snprintf(buf, sizeof(buf), "File: %.500s", app->save_path);
-    draw_text_centered(fb, cx, y, buf, COL_TEXT, 1);
+            uint64_t t0 = time_us();
+            struct input_event in;
+            if (mode == 0) {
+                for (int i = 0; i < app->num_controllers; i++) {
+                    reads++;
+                    while (read(app->controllers[i].fd, &in, sizeof(in)) ==
+                           (ssize_t)sizeof(in)) {
+                        events++;
+                        reads++;
+                    }
+                }
+            } else if (mode == 2) {
+                uint64_t last = 0;
+                int fd;
+                merge_begin(&app->merge);
+                merge_add_ready(&app->merge, app->ctrl_epfd);
+                /* the batch, then EAGAIN when drained */
+                reads += 2 * app->merge.num_heap;
+                while (merge_next(&app->merge, &in, &fd)) {
+                    if (ctrl_slot(app, fd) < 0) continue;
+                    if (event_time_us(&in) < last)
+                        fprintf(stderr, "bench: merge out of order\n");
+                    last = event_time_us(&in);
+                    events++;
+                }
+            } else {
+                struct epoll_event ready[READY_EVENTS];
+                int m = epoll_wait(app->ctrl_epfd, ready, READY_EVENTS, 0);
+                for (int k = 0; k < m; k++) {
+                    int i = ctrl_slot(app, ready[k].data.fd);
+                    if (i < 0) continue;
+                    reads++;
+                    while (read(app->controllers[i].fd, &in, sizeof(in)) ==
+                           (ssize_t)sizeof(in)) {
+                        events++;
+                        reads++;
+                    }
+                }
+            }
+            us += time_us() - t0;
+        }
+        printf("%-22s %8.2f us/frame %8.0f ns/event %6.1f reads/frame\n",
+               names[mode],
+               (double)us / frames, events ? us * 1000.0 / events : 0.0,
+               (double)reads / frames);
+    }
 
-    y += 40;
-    draw_text(fb, 60, y, "Contents:", COL_TEXT_DIM, 1);
-    y += 24;
+    close_controllers(app);
+    for (int i = 0; i < n; i++)
+        close(pipes[i][1]);
+    free(pipes);
+    free(app->controllers);
+    free(app->fd_slot);
+    close(app->ctrl_epfd);
+    close(app->kbd_epfd);
+    return 0;
+}
 
-    /* wrap mapping string */
-    int mlen = strlen(app->mapping_str);
-    int chars_per_line = (fb->width - 120) / (FONT_W * 1);
-    int off = 0;
-    while (off < mlen) {
-        int chunk = mlen - off;
-        if (chunk > chars_per_line) chunk = chars_per_line;
-        char line[512];
-        memcpy(line, app->mapping_str + off, chunk);
-        line[chunk] = '\0';
-        draw_text(fb, 60, y, line, COL_TEXT, 1);
-        y += 18;
-        off += chunk;
-    }
+/* Memory footprint of the main structures, with the old fixed-size
+ * layout (int tables indexed by raw code, 256 inline browser entries,
+ * 8 inline controllers) for comparison */
+static void print_footprint(void)
+{
+    size_t tables = sizeof(((Controller *)0)->axes) +
+                    sizeof(((Controller *)0)->btn_map) +
+                    sizeof(((Controller *)0)->abs_map) +
+                    sizeof(((Controller *)0)->hat_map);
+    size_t old_tables = (KEY_MAX + 5 * ABS_MAX) * sizeof(int);
+    size_t old_ctrl = sizeof(Controller) - tables + old_tables;
+    size_t old_browser = 256 * (MAX_NAME_LEN + sizeof(int)) + MAX_PATH_LEN;
+
+    printf("%-22s %8s %8s\n", "structure", "now", "before");
+    printf("%-22s %8zu %8zu\n", "Controller tables", tables, old_tables);
+    printf("%-22s %8zu %8zu\n", "Controller", sizeof(Controller), old_ctrl);
+    printf("%-22s %8zu %8zu  (+ %zu bytes/entry on the heap)\n",
+           "DirBrowser", sizeof(DirBrowser), old_browser,
+           sizeof(uint32_t) + 1);
+    printf("%-22s %8zu %8zu  (+ %zu bytes/controller on the heap)\n", "App",
+           sizeof(App), sizeof(App) + 8 * old_ctrl + 8 * sizeof(int) +
+           old_browser - sizeof(DirBrowser), sizeof(Controller));
+    printf("App is static; names in the browser arena cost strlen + 1.\n");
+}
 
-    y += 30;
-    draw_text_centered(fb, cx, y, "Press any button to exit", COL_TEXT_DIM, 2);
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s                      run the framebuffer GUI\n"
+            "       %s --cli DEVICE [-o OUTPUT] [-s SCRIPT]\n"
+            "       %s --batch LIST\n"
+            "       %s --launch             stop the64, run the GUI, restart the64\n"
+            "       %s --footprint          print structure sizes\n"
+            "       %s --bench N            event dispatch with N simulated devices\n"
+            "       %s --watch [--db FILE] [-o DIR] [GUI options]\n"
+            "                               wait for pads, map the unknown ones\n"
+            "GUI options:\n"
+            "       --realtime              SCHED_FIFO main loop, mlockall\n"
+            "       --cpus MAIN[,WORKER]    cores for main loop and workers\n"
+            "       --record FILE           record the screen (gamepad_rec2png)\n"
+            "       --telemetry FILE        append a record per session (gamepad_tlm)\n"
+            "       --control SOCKET        accept commands on a Unix socket\n"
+            "       --font FILE             PSF2 font for non-ASCII text (default ./"
+            FONT_FILE ")\n",
+            prog, prog, prog, prog, prog, prog, prog);
 }
 
 /* ================================================================
  * Main
  * ================================================================ */
 
-int main(void)
+int main(int argc, char **argv)
 {
-    App app;
-    memset(&app, 0, sizeof(app));
+    static App app;  /* too big for the stack */
 
     signal(SIGINT, sig_handler);
     signal(SIGTERM, sig_handler);
 
+    static const struct option long_opts[] = {
+        { "cli",    required_argument, NULL, 'c' },
+        { "batch",  required_argument, NULL, 'b' },
+        { "output", required_argument, NULL, 'o' },
+        { "script", required_argument, NULL, 's' },
+        { "launch", no_argument,       NULL, 'l' },
+        { "realtime", no_argument,     NULL, 'r' },
+        { "cpus",   required_argument, NULL, 'p' },
+        { "footprint", no_argument,    NULL, 'f' },
+        { "record", required_argument, NULL, 'R' },
+        { "telemetry", required_argument, NULL, 't' },
+        { "bench",  required_argument, NULL, 'B' },
+        { "control", required_argument, NULL, 'C' },
+        { "font",   required_argument, NULL, 'F' },
+        { "watch",  no_argument,       NULL, 'w' },
+        { "db",     required_argument, NULL, 'd' },
+        { "help",   no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *cli_device = NULL, *batch_list = NULL;
+    const char *output = NULL, *script = NULL, *record = NULL;
+    const char *telemetry = NULL, *control = NULL, *font = NULL;
+    const char *cpus = NULL, *db = GCDB_PATH;
+    int launch = 0, watch = 0;
+    int first_frame = 1;
+    FrameStats fstats = { 0 };
+    uint64_t frame_no = 0;
+    int opt;
+
+    prof_begin();
+
+    while ((opt = getopt_long(argc, argv, "c:b:o:s:lrp:fR:t:B:C:F:wd:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'c': cli_device = optarg; break;
+        case 'b': batch_list = optarg; break;
+        case 'o': output = optarg;     break;
+        case 's': script = optarg;     break;
+        case 'l': launch = 1;          break;
+        case 'r': g_rt.enabled = 1;    break;
+        case 'R': record = optarg;     break;
+        case 't': telemetry = optarg;  break;
+        case 'C': control = optarg;    break;
+        case 'F': font = optarg;       break;
+        case 'w': watch = 1;           break;
+        case 'd': db = optarg;         break;
+        case 'f': print_footprint();   return 0;
+        case 'B':
+            return bench_registry(&app, atoi(optarg) > 0 ? atoi(optarg) : 64)
+                   == 0 ? 0 : 1;
+        case 'p':
+            if (parse_cpus(optarg) < 0) { usage(argv[0]); return 1; }
+            cpus = optarg;
+            break;
+        default:  usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (batch_list)
+        return cli_run_batch(&app, batch_list) == 0 ? 0 : 1;
+    if (cli_device)
+        return cli_run_session(&app, cli_device, output, script) == 0 ? 0 : 1;
+    if (watch) {
+        /* the GUI child gets the options that apply to it */
+        char *gui[16];
+        int n = 0;
+        gui[n++] = argv[0];
+        gui[n++] = "--launch";
+        if (g_rt.enabled) gui[n++] = "--realtime";
+        if (cpus)      { gui[n++] = "--cpus";      gui[n++] = (char *)cpus; }
+        if (record)    { gui[n++] = "--record";    gui[n++] = (char *)record; }
+        if (telemetry) { gui[n++] = "--telemetry"; gui[n++] = (char *)telemetry; }
+        if (control)   { gui[n++] = "--control";   gui[n++] = (char *)control; }
+        if (font)      { gui[n++] = "--font";      gui[n++] = (char *)font; }
+        gui[n] = NULL;
+        return watch_run(db, output ? output : "/mnt", gui) == 0 ? 0 : 1;
+    }
+
+    tlm_open(&app.tlm, telemetry);
+
+    if (launch) {
+        int n = stop_the64();
+        prof_mark("stop the64");
+        fprintf(stderr, "Stopped %d the64 process(es) in %.1f ms\n", n,
+                g_prof[g_prof_count - 1].us / 1000.0);
+    }
+
     if (fb_init(&app.fb) < 0) {
         fprintf(stderr, "Failed to initialize framebuffer\n");
+        if (launch) relaunch_the64();
         return 1;
     }
+    prof_mark("fb_init");
+    font_load(font ? font : FONT_FILE, font == NULL);
+    if (g_rt.enabled) {
+        realtime_setup(&app.fb);
+        prof_mark("realtime setup");
+    }
+    if (record && rec_start(&app.rec, record, &app.fb) == 0)
+        prof_mark("recorder");
 
     app.state = STATE_DETECT;
     init_mappings(app.mappings);
+    mappings_changed(&app);
     app.sel_ctrl = -1;
     app.thec64_nav_idx = -1;
     app.redo_single = -1;
     app.review_sel = 0;
+    app.detect_active = -1;
 
+    if (registry_init(&app) < 0) {
+        fb_destroy(&app.fb);
+        if (launch) relaunch_the64();
+        return 1;
+    }
+    if (ctl_open(&app.ctl, control) < 0)
+        fprintf(stderr, "continuing without the control socket\n");
     scan_controllers(&app);
-    scan_keyboards(&app);
     app.last_scan = time_ms();
+    prof_mark("scan_controllers");
 
     /* Main loop */
     while (app.state != STATE_EXIT && !g_quit) {
         uint64_t now = time_ms();
+        uint64_t frame_start = time_us();
 
         /* Update blink */
         if (now - app.blink_time > BLINK_MS) {
@@ -1854,41 +5431,108 @@ int main(void)
             app.blink_time = now;
         }
 
+        poll_save_results(&app);
+        ctl_poll(&app);
+
         /* State update */
         switch (app.state) {
         case STATE_DETECT:  update_detect(&app);  break;
         case STATE_MAPPING: update_mapping(&app);  break;
         case STATE_REVIEW:  update_review(&app);   break;
         case STATE_BROWSE:  update_browse(&app);   break;
+        case STATE_TEST:    update_test(&app);     break;
         case STATE_DONE:    update_done(&app);     break;
         default: break;
         }
 
         /* Render */
-        fb_clear(&app.fb, COL_BG);
+        if (app.state == STATE_TEST) {
+            render_test(&app);  /* flips only what changed */
+        } else {
+            fb_clear(&app.fb, COL_BG);
+
+            switch (app.state) {
+            case STATE_DETECT:  render_detect(&app);   break;
+            case STATE_MAPPING: render_mapping(&app);  break;
+            case STATE_REVIEW:  render_review(&app);   break;
+            case STATE_BROWSE:  render_browse(&app);   break;
+            case STATE_DONE:    render_done(&app);     break;
+            default: break;
+            }
 
-        switch (app.state) {
-        case STATE_DETECT:  render_detect(&app);   break;
-        case STATE_MAPPING: render_mapping(&app);  break;
-        case STATE_REVIEW:  render_review(&app);   break;
-        case STATE_BROWSE:  render_browse(&app);   break;
-        case STATE_DONE:    render_done(&app);     break;
-        default: break;
+            fb_flip(&app.fb);
+        }
+        rec_frame(&app.rec, &app.fb);
+
+        if (first_frame) {
+            /* anything not needed to draw the detect screen starts here */
+            first_frame = 0;
+            prof_mark("first frame");
+            if (launch)
+                fprintf(stderr, "Hand-off: first frame %.1f ms after start\n",
+                        (g_prof_last - g_prof_start) / 1000.0);
+            scan_keyboards(&app);
+            prof_mark("scan_keyboards");
+            save_queue_start(&app.saveq);
+            dir_cache_start(&app.dircache);
+            app.browser.cache = &app.dircache;
+            prof_mark("worker threads");
         }
-
-        fb_flip(&app.fb);
 
         /* Cap frame rate */
-        usleep(FRAME_MS * 1000);
+        uint64_t work = time_us() - frame_start;
+        if (app.state == STATE_TEST) {
+            /* wake as soon as the pad under test reports anything */
+            struct pollfd pfd = { .fd = app.controllers[app.sel_ctrl].fd,
+                                  .events = POLLIN };
+            poll(&pfd, 1, FRAME_MS);
+        } else {
+            usleep(FRAME_MS * 1000);
+        }
+        int64_t late = (int64_t)(time_us() - frame_start - work) -
+                       FRAME_MS * 1000;
+        if (late < 0) late = 0;  /* sleep cut short by a signal */
+
+        /* the first frame carries the deferred startup work; skip it */
+        if (frame_no++ > 0) {
+            if (work > fstats.work_max_us) fstats.work_max_us = work;
+            if ((uint64_t)late > fstats.late_max_us)
+                fstats.late_max_us = late;
+            fstats.late_sum_us += late;
+            fstats.frames++;
+        }
     }
 
     /* Restore framebuffer to black */
     fb_clear(&app.fb, 0xFF000000);
     fb_flip(&app.fb);
 
+    /* let queued saves reach the stick before exiting */
+    save_queue_stop(&app.saveq);
+    if (app.save_retry.path[0] &&
+        save_mapping_file(app.save_retry.path, app.save_retry.data) < 0)
+        perror(app.save_retry.path);
+    dir_cache_stop(&app.dircache);
+    rec_stop(&app.rec);
+    ctl_close(&app.ctl);
+    tlm_close(&app.tlm, TLM_END_QUIT);
+
     close_controllers(&app);
     close_keyboards(&app);
+    free(app.controllers);
+    free(app.fd_slot);
+    close(app.ctrl_epfd);
+    close(app.kbd_epfd);
+    browser_free(&app.browser);
+    free(app.test.base);
     fb_destroy(&app.fb);
+    font_unload();
+
+    prof_report();
+    frame_stats_report(&fstats);
+
+    if (launch)
+        relaunch_the64();
 
     return 0;
 }
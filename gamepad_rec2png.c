@@ -0,0 +1,287 @@
+/*
+ * gamepad_rec2png - Convert a gamepad_map screen recording to PNG frames
+ *
+ * Reads the file written by `gamepad_map --record FILE`, replays the
+ * changed tiles of each frame onto a canvas and writes every frame as
+ * OUTDIR/frame_NNNNN.png. One "name milliseconds" line per frame is
+ * printed on stdout, e.g. to build an ffmpeg concat list with real
+ * frame durations.
+ *
+ * Runs on the host. Only depends on libc: the PNGs use stored
+ * (uncompressed) deflate blocks, so they are large but need no zlib.
+ *
+ * Compile:
+ *   gcc -O2 -o gamepad_rec2png gamepad_rec2png.c
+ *
+ * Usage:
+ *   gamepad_rec2png session.rec outdir
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+/* Must match the recording section of gamepad_map.c */
+#define REC_VERSION 1
+
+static uint32_t crc_table[256];
+
+static void crc_init(void)
+{
+    uint32_t c;
+    int n, k;
+
+    for (n = 0; n < 256; n++) {
+        c = (uint32_t)n;
+        for (k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    while (len--)
+        crc = crc_table[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* Write one PNG chunk: length, type, data, CRC over type and data */
+static int write_chunk(FILE *f, const char *type, const uint8_t *data,
+                       uint32_t len)
+{
+    uint8_t b[4];
+    uint32_t crc;
+
+    be32(b, len);
+    fwrite(b, 1, 4, f);
+    fwrite(type, 1, 4, f);
+    if (len)
+        fwrite(data, 1, len, f);
+    crc = crc_update(0xFFFFFFFFu, (const uint8_t *)type, 4);
+    crc = crc_update(crc, data, len);
+    be32(b, crc ^ 0xFFFFFFFFu);
+    return fwrite(b, 1, 4, f) == 4 ? 0 : -1;
+}
+
+/*
+ * Write an RGB canvas as a PNG. The image data is every row prefixed
+ * by filter type 0, wrapped in a zlib stream of stored blocks.
+ */
+static int write_png(const char *path, const uint8_t *rgb, int w, int h)
+{
+    size_t row = (size_t)w * 3 + 1;
+    size_t raw_len = row * h;
+    size_t blocks = (raw_len + 65534) / 65535;
+    size_t idat_len = 2 + raw_len + blocks * 5 + 4;
+    uint8_t *idat, *p;
+    uint8_t ihdr[13];
+    uint32_t a = 1, b = 0;
+    size_t done, y;
+    FILE *f;
+    int rc;
+
+    idat = malloc(idat_len);
+    if (!idat)
+        return -1;
+
+    p = idat;
+    *p++ = 0x78;    /* deflate, 32K window */
+    *p++ = 0x01;
+    done = 0;
+    y = 0;
+    while (done < raw_len) {
+        size_t n = raw_len - done;
+        if (n > 65535)
+            n = 65535;
+        *p++ = done + n == raw_len;     /* BFINAL, BTYPE 00 */
+        *p++ = n & 0xFF;
+        *p++ = n >> 8;
+        *p++ = ~n & 0xFF;
+        *p++ = (~n >> 8) & 0xFF;
+        for (size_t i = 0; i < n; i++, done++) {
+            size_t off = done % row;
+            uint8_t v = off == 0 ? 0 : rgb[y * (row - 1) + off - 1];
+            if (off == row - 1)
+                y++;
+            *p++ = v;
+            a = (a + v) % 65521;
+            b = (b + a) % 65521;
+        }
+    }
+    be32(p, b << 16 | a);
+
+    be32(ihdr, w);
+    be32(ihdr + 4, h);
+    ihdr[8] = 8;     /* bit depth */
+    ihdr[9] = 2;     /* truecolour */
+    ihdr[10] = 0;    /* deflate */
+    ihdr[11] = 0;    /* adaptive filtering */
+    ihdr[12] = 0;    /* no interlace */
+
+    f = fopen(path, "wb");
+    if (!f) {
+        free(idat);
+        return -1;
+    }
+    fwrite("\x89PNG\r\n\x1a\n", 1, 8, f);
+    rc = write_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+    if (rc == 0)
+        rc = write_chunk(f, "IDAT", idat, idat_len);
+    if (rc == 0)
+        rc = write_chunk(f, "IEND", NULL, 0);
+    if (fclose(f) != 0)
+        rc = -1;
+    free(idat);
+    return rc;
+}
+
+/*
+ * Decode one tile's RLE data into the canvas. Returns -1 if the data
+ * does not describe exactly tw * th pixels.
+ */
+static int decode_tile(uint8_t *canvas, int width, int x0, int y0,
+                       int tw, int th, const uint8_t *d, uint32_t len)
+{
+    const uint8_t *end = d + len;
+    int n = tw * th, i = 0;
+
+    while (i < n && d < end) {
+        int c = *d++;
+        int count = c < 128 ? c + 1 : c - 126;
+        int literal = c < 128;
+
+        if (i + count > n || end - d < (literal ? 3 * count : 3))
+            return -1;
+        for (int k = 0; k < count; k++, i++) {
+            uint8_t *px = canvas + ((size_t)(y0 + i / tw) * width +
+                                    x0 + i % tw) * 3;
+            px[0] = d[0];
+            px[1] = d[1];
+            px[2] = d[2];
+            if (literal)
+                d += 3;
+        }
+        if (!literal)
+            d += 3;
+    }
+    return i == n && d == end ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t hdr[16], fh[8], th[8];
+    uint8_t *canvas, *data = NULL;
+    size_t data_cap = 0;
+    char path[4096];
+    int width, height, tile;
+    unsigned frame = 0;
+    FILE *in;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s RECORDING OUTDIR\n", argv[0]);
+        return 1;
+    }
+
+    in = fopen(argv[1], "rb");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (fread(hdr, 1, sizeof(hdr), in) != sizeof(hdr) ||
+        memcmp(hdr, "GMRC", 4) != 0 || get16(hdr + 4) != REC_VERSION) {
+        fprintf(stderr, "%s: not a gamepad_map recording\n", argv[1]);
+        return 1;
+    }
+    tile = get16(hdr + 6);
+    width = get16(hdr + 8);
+    height = get16(hdr + 10);
+    if (tile == 0 || width == 0 || height == 0) {
+        fprintf(stderr, "%s: bad header\n", argv[1]);
+        return 1;
+    }
+
+    crc_init();
+    if (mkdir(argv[2], 0755) < 0 && errno != EEXIST) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    canvas = calloc((size_t)width * height, 3);
+    if (!canvas) {
+        perror("calloc");
+        return 1;
+    }
+
+    while (fread(fh, 1, sizeof(fh), in) == sizeof(fh)) {
+        uint32_t ms = get32(fh);
+        int ntiles = get16(fh + 4);
+
+        for (int t = 0; t < ntiles; t++) {
+            if (fread(th, 1, sizeof(th), in) != sizeof(th))
+                goto truncated;
+            int tx = get16(th), ty = get16(th + 2);
+            uint32_t len = get32(th + 4);
+            int x0 = tx * tile, y0 = ty * tile;
+            int tw = width - x0 < tile ? width - x0 : tile;
+            int tht = height - y0 < tile ? height - y0 : tile;
+
+            if (len > data_cap) {
+                free(data);
+                data_cap = len;
+                data = malloc(data_cap);
+                if (!data) {
+                    perror("malloc");
+                    return 1;
+                }
+            }
+            if (fread(data, 1, len, in) != len)
+                goto truncated;
+            if (x0 >= width || y0 >= height ||
+                decode_tile(canvas, width, x0, y0, tw, tht, data, len) < 0) {
+                fprintf(stderr, "%s: frame %u: bad tile %d,%d\n",
+                        argv[1], frame, tx, ty);
+                return 1;
+            }
+        }
+
+        snprintf(path, sizeof(path), "%s/frame_%05u.png", argv[2], frame);
+        if (write_png(path, canvas, width, height) < 0) {
+            perror(path);
+            return 1;
+        }
+        printf("%s %u\n", path, ms);
+        frame++;
+    }
+
+    fclose(in);
+    fprintf(stderr, "%u frames, %dx%d\n", frame, width, height);
+    return 0;
+
+truncated:
+    /* the device may have lost power mid-write; keep what was complete */
+    fprintf(stderr, "%s: truncated after %u frames\n", argv[1], frame);
+    fclose(in);
+    return 0;
+}
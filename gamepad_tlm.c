@@ -0,0 +1,232 @@
+/*
+ * gamepad_tlm - Summarise gamepad_map session telemetry
+ *
+ * Reads one or more logs written by `gamepad_map --telemetry FILE`
+ * (e.g. collected from many USB sticks) and prints per-controller-model
+ * statistics: sessions, how many were saved, mean time to save, redos,
+ * restarts and duplicate warnings per session, and the mean time spent
+ * on each of the ten mapping prompts.
+ *
+ * A controller model is identified by its GUID (bus, vendor, product
+ * and version), so the same pad type logged on different sticks is
+ * aggregated together.
+ *
+ * Runs on the host. Only depends on libc.
+ *
+ * Compile:
+ *   gcc -O2 -o gamepad_tlm gamepad_tlm.c
+ *
+ * Usage:
+ *   gamepad_tlm stick1/gamepad_map.tlm stick2/gamepad_map.tlm ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* Must match the session telemetry section of gamepad_map.c */
+#define TLM_MAGIC      0x4C54
+#define TLM_RECORD_LEN 136
+#define TLM_NAME_LEN   40
+#define NUM_PROMPTS    10
+
+/* gcdb names of the prompts, in init_mappings() order */
+static const char *prompt_names[NUM_PROMPTS] = {
+    "lefttrigger", "righttrigger", "y", "x", "a",
+    "b", "back", "start", "leftx", "lefty"
+};
+
+typedef struct {
+    char     guid[33];
+    char     name[TLM_NAME_LEN + 1];
+    unsigned sessions;
+    unsigned saved;
+    unsigned save_failures;
+    unsigned redos;
+    unsigned restarts;
+    unsigned dup_warnings;
+    double   save_ms;              /* sum over saved sessions */
+    double   total_ms;
+    double   prompt_ms[NUM_PROMPTS];
+} Model;
+
+static Model   *models;
+static unsigned num_models, cap_models;
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static Model *find_model(const char *guid, const char *name)
+{
+    unsigned i;
+
+    for (i = 0; i < num_models; i++)
+        if (strcmp(models[i].guid, guid) == 0)
+            return &models[i];
+
+    if (num_models == cap_models) {
+        unsigned cap = cap_models ? cap_models * 2 : 16;
+        Model *m = realloc(models, cap * sizeof(Model));
+        if (!m)
+            return NULL;
+        models = m;
+        cap_models = cap;
+    }
+    Model *m = &models[num_models++];
+    memset(m, 0, sizeof(*m));
+    strcpy(m->guid, guid);
+    strcpy(m->name, name);
+    return m;
+}
+
+static void add_record(const uint8_t *r)
+{
+    char guid[33], name[TLM_NAME_LEN + 1];
+    const uint8_t *p = r + 8;
+    Model *m;
+    int i;
+
+    memcpy(guid, p, 32);
+    guid[32] = '\0';
+    p += 32;
+    memcpy(name, p, TLM_NAME_LEN);
+    name[TLM_NAME_LEN] = '\0';
+    p += TLM_NAME_LEN;
+
+    m = find_model(guid, name);
+    if (!m) {
+        perror("realloc");
+        exit(1);
+    }
+
+    m->sessions++;
+    for (i = 0; i < NUM_PROMPTS; i++, p += 4)
+        m->prompt_ms[i] += get32(p);
+    m->redos += get16(p);
+    m->restarts += get16(p + 2);
+    m->dup_warnings += get16(p + 4);
+    /* p[6] is the outcome (1 = another controller, 2 = quit) */
+    m->save_failures += p[7];
+    if (get32(p + 8)) {
+        m->saved++;
+        m->save_ms += get32(p + 8);
+    }
+    m->total_ms += get32(p + 12);
+}
+
+/* Read every record of one log. Returns the number of records. */
+static long read_log(const char *path)
+{
+    uint8_t hdr[4], rec[TLM_RECORD_LEN];
+    long n = 0;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    while (fread(hdr, 1, 4, f) == 4) {
+        uint16_t len = get16(hdr + 2);
+
+        if (get16(hdr) != TLM_MAGIC || len < TLM_RECORD_LEN) {
+            fprintf(stderr, "%s: bad record at offset %ld\n", path,
+                    ftell(f) - 4);
+            break;
+        }
+        memcpy(rec, hdr, 4);
+        if (fread(rec + 4, 1, TLM_RECORD_LEN - 4, f) != TLM_RECORD_LEN - 4) {
+            fprintf(stderr, "%s: truncated record\n", path);
+            break;
+        }
+        /* newer writers may append fields; skip what we do not know */
+        if (len > TLM_RECORD_LEN && fseek(f, len - TLM_RECORD_LEN, SEEK_CUR) < 0)
+            break;
+        add_record(rec);
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+static int by_sessions(const void *a, const void *b)
+{
+    const Model *ma = a, *mb = b;
+
+    if (ma->sessions != mb->sessions)
+        return ma->sessions < mb->sessions ? 1 : -1;
+    return strcmp(ma->guid, mb->guid);
+}
+
+int main(int argc, char **argv)
+{
+    double all_prompt[NUM_PROMPTS] = { 0 };
+    unsigned all_sessions = 0;
+    long records = 0;
+    unsigned i;
+    int a, k;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s LOG...\n", argv[0]);
+        return 1;
+    }
+
+    for (a = 1; a < argc; a++) {
+        long n = read_log(argv[a]);
+        if (n > 0)
+            records += n;
+    }
+    if (num_models == 0) {
+        printf("No sessions found.\n");
+        return 0;
+    }
+    qsort(models, num_models, sizeof(Model), by_sessions);
+
+    printf("%ld sessions, %u controller models\n\n", records, num_models);
+    printf("%-32s %-24s %5s %5s %8s %8s %6s %6s %6s\n",
+           "GUID", "name", "sess", "saved", "save s", "total s",
+           "redo", "restrt", "dups");
+    for (i = 0; i < num_models; i++) {
+        Model *m = &models[i];
+        double n = m->sessions;
+
+        printf("%-32s %-24.24s %5u %5u %8.1f %8.1f %6.2f %6.2f %6.2f\n",
+               m->guid, m->name, m->sessions, m->saved,
+               m->saved ? m->save_ms / m->saved / 1000.0 : 0.0,
+               m->total_ms / n / 1000.0,
+               m->redos / n, m->restarts / n, m->dup_warnings / n);
+        if (m->save_failures)
+            printf("%-32s %u failed save(s)\n", "", m->save_failures);
+    }
+
+    printf("\nMean seconds per prompt (including redos):\n%-32s", "GUID");
+    for (k = 0; k < NUM_PROMPTS; k++)
+        printf(" %6.6s", prompt_names[k]);
+    printf("\n");
+    for (i = 0; i < num_models; i++) {
+        Model *m = &models[i];
+
+        printf("%-32s", m->guid);
+        for (k = 0; k < NUM_PROMPTS; k++) {
+            printf(" %6.1f", m->prompt_ms[k] / m->sessions / 1000.0);
+            all_prompt[k] += m->prompt_ms[k];
+        }
+        printf("\n");
+        all_sessions += m->sessions;
+    }
+    printf("%-32s", "all");
+    for (k = 0; k < NUM_PROMPTS; k++)
+        printf(" %6.1f", all_prompt[k] / all_sessions / 1000.0);
+    printf("\n");
+
+    free(models);
+    return 0;
+}